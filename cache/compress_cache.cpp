@@ -0,0 +1,199 @@
+#include<stdio.h>
+#include<string.h>
+#include<errno.h>
+#include<unistd.h>
+#include<fcntl.h>
+#include<zlib.h>
+
+#include"compress_cache.h"
+#include"../http/mime.h"
+
+// 限制每个响应的压缩开销：更大的文件不压缩，较大的文件使用最快的压缩级别
+static const long COMPRESS_MAX_SIZE = 1024 * 1024;
+static const long COMPRESS_FAST_SIZE = 256 * 1024;
+
+// 条目占用的内存，没有压缩结果的条目也要计入，保证缓存的条目数有上限
+static size_t entry_size(const compress_entry* entry) {
+    return entry->len + entry->key.size() + sizeof(compress_entry);
+}
+
+compress_cache::compress_cache(): m_min_size(-1), m_max_bytes(0), m_bytes(0) {
+}
+
+compress_cache::~compress_cache() {
+    for (std::list<compress_entry*>::iterator it = m_lru.begin(); it != m_lru.end(); ++it) {
+        free_entry(*it);
+    }
+}
+
+// 局部静态变量单例模式
+compress_cache* compress_cache::get_instance() {
+    static compress_cache cache;
+    return &cache;
+}
+
+void compress_cache::init(long min_size, size_t max_bytes) {
+    m_min_size = min_size;
+    m_max_bytes = max_bytes;
+}
+
+const content_encoding* compress_cache::select(const char* path, const struct stat& st, int accept_encoding) {
+    if (m_min_size < 0 || st.st_size < m_min_size || st.st_size > COMPRESS_MAX_SIZE || st.st_size == 0) {
+        return NULL;
+    }
+    // 预压缩的变体和非文本资源都不再压缩
+    if (!get_mime_type(path)->compressible || get_content_encoding(path)) {
+        return NULL;
+    }
+    // gzip优先，deflate在个别客户端上存在兼容问题
+    for (int i = 0; i < CONTENT_ENCODING_COUNT; i++) {
+        int flag = content_encodings[i].flag;
+        if ((flag == ENCODING_GZIP || flag == ENCODING_DEFLATE) && (accept_encoding & flag)) {
+            return &content_encodings[i];
+        }
+    }
+    return NULL;
+}
+
+compress_entry* compress_cache::acquire(const char* path, const struct stat& st, const content_encoding* encoding,
+                                        bool* miss) {
+    char key[128];
+    snprintf(key, sizeof(key), "%lx-%llx-%lx-%lx-%s:", (unsigned long)st.st_ino, (unsigned long long)st.st_size,
+             (unsigned long)st.st_mtim.tv_sec, (unsigned long)st.st_mtim.tv_nsec, encoding->name);
+    std::string full_key = std::string(key) + path;
+    {
+        locker_RAII lock_RAII(m_lock);
+        std::unordered_map<std::string, compress_entry*>::iterator it = m_entries.find(full_key);
+        if (it != m_entries.end()) {
+            // 命中，移到LRU链表头部
+            compress_entry* entry = it->second;
+            m_lru.splice(m_lru.begin(), m_lru, entry->lru);
+            if (!entry->data) {
+                return NULL;
+            }
+            entry->ref++;
+            return entry;
+        }
+    }
+    if (miss) {
+        *miss = true;
+        return NULL;
+    }
+
+    // 压缩不持有锁，多个线程同时未命中同一文件时各自压缩，只有第一个结果被缓存
+    compress_entry* entry = load(path, st, encoding);
+    if (!entry) {
+        return NULL;
+    }
+    entry->key = full_key;
+    entry->ref = 1;
+
+    locker_RAII lock_RAII(m_lock);
+    if (m_entries.count(full_key) == 0 && entry_size(entry) <= m_max_bytes) {
+        entry->cached = true;
+        m_lru.push_front(entry);
+        entry->lru = m_lru.begin();
+        m_entries[entry->key] = entry;
+        m_bytes += entry_size(entry);
+        shrink();
+    }
+    if (!entry->data) {
+        if (--entry->ref == 0 && !entry->cached) {
+            free_entry(entry);
+        }
+        return NULL;
+    }
+    return entry;
+}
+
+void compress_cache::release(compress_entry* entry) {
+    locker_RAII lock_RAII(m_lock);
+    if (--entry->ref == 0 && !entry->cached) {
+        free_entry(entry);
+    }
+}
+
+compress_entry* compress_cache::load(const char* path, const struct stat& st, const content_encoding* encoding) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+    // 调用者stat之后文件可能被替换或截断，打开的必须还是缓存键对应的那个文件
+    struct stat opened;
+    if (fstat(fd, &opened) < 0 || opened.st_ino != st.st_ino || opened.st_size != st.st_size ||
+        opened.st_mtim.tv_sec != st.st_mtim.tv_sec || opened.st_mtim.tv_nsec != st.st_mtim.tv_nsec) {
+        close(fd);
+        return NULL;
+    }
+    // 读入内存再压缩，而不是mmap：压缩期间文件被截断时访问映射会触发SIGBUS，read只会读到更少的数据
+    char* src = new char[st.st_size];
+    off_t total = 0;
+    while (total < st.st_size) {
+        ssize_t n = read(fd, src + total, st.st_size - total);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        total += n;
+    }
+    close(fd);
+    if (total != st.st_size) {
+        delete[] src;
+        return NULL;
+    }
+
+    // windowBits加16输出gzip格式，否则输出HTTP中deflate编码所指的zlib格式
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    int level = st.st_size > COMPRESS_FAST_SIZE ? Z_BEST_SPEED : Z_DEFAULT_COMPRESSION;
+    int window_bits = encoding->flag == ENCODING_GZIP ? MAX_WBITS + 16 : MAX_WBITS;
+    if (deflateInit2(&stream, level, Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        delete[] src;
+        return NULL;
+    }
+    // 压缩后不比原文件小就没有意义，输出缓冲区按原文件大小分配，放不下即放弃
+    char* data = new char[st.st_size];
+    stream.next_in = (Bytef*)src;
+    stream.avail_in = st.st_size;
+    stream.next_out = (Bytef*)data;
+    stream.avail_out = st.st_size;
+    int ret = deflate(&stream, Z_FINISH);
+    size_t len = stream.total_out;
+    deflateEnd(&stream);
+    delete[] src;
+    if (ret != Z_STREAM_END) {
+        delete[] data;
+        data = NULL;
+        len = 0;
+    }
+
+    compress_entry* entry = new compress_entry;
+    entry->data = data;
+    entry->len = len;
+    make_file_meta(&entry->meta, path, st, encoding);
+    const mime_type* type = get_mime_type(path);
+    entry->header_len = snprintf(entry->header, sizeof(entry->header), "HTTP/1.1 200 OK\r\nContent-Length: %ld\r\n%s%s",
+                                 (long)len, type->header, entry->meta.headers);
+    entry->cached = false;
+    return entry;
+}
+
+void compress_cache::shrink() {
+    while (m_bytes > m_max_bytes && !m_lru.empty()) {
+        compress_entry* entry = m_lru.back();
+        m_lru.pop_back();
+        m_entries.erase(entry->key);
+        m_bytes -= entry_size(entry);
+        entry->cached = false;
+        if (entry->ref == 0) {
+            free_entry(entry);
+        }
+    }
+}
+
+void compress_cache::free_entry(compress_entry* entry) {
+    delete[] entry->data;
+    delete entry;
+}
@@ -0,0 +1,73 @@
+// 即时压缩的响应内容缓存，为没有预压缩变体的文本资源生成gzip或deflate压缩后的内容
+// 以(文件路径, inode, 大小, 修改时间, 编码)为键，文件改变后键随之改变，旧的条目不再命中，按LRU淘汰
+// 压缩在调用acquire()的工作线程中完成，同一个文件同一种编码只压缩一次，总大小不超过设定的上限
+#ifndef COMPRESS_CACHE_H
+#define COMPRESS_CACHE_H
+
+#include<sys/stat.h>
+#include<string>
+#include<list>
+#include<unordered_map>
+
+#include"../lock/locker.h"
+#include"../http/file_meta.h"
+
+// 一个文件压缩后的内容
+struct compress_entry {
+    std::string key;
+    // 压缩后的内容，压缩后没有变小时为NULL，记录下来避免重复压缩
+    char* data;
+    size_t len;
+    // 压缩后内容的ETag、Content-Encoding等元信息
+    file_meta meta;
+    // 预先生成的状态行、Content-Length、Content-Type和元信息首部
+    char header[512];
+    int header_len;
+    // 正在使用该条目的请求数
+    int ref;
+    // 是否仍在缓存中，被淘汰后为false，引用计数归零时释放
+    bool cached;
+    // 在LRU链表中的位置
+    std::list<compress_entry*>::iterator lru;
+};
+
+class compress_cache {
+    public:
+        // 局部静态变量单例模式
+        static compress_cache* get_instance();
+
+        // 初始化，不小于min_size字节的可压缩资源才压缩，min_size为负数时不压缩；压缩结果最多缓存max_bytes字节
+        void init(long min_size, size_t max_bytes);
+        // 根据文件和客户端接受的编码选择即时压缩使用的编码，不压缩时返回NULL
+        const content_encoding* select(const char* path, const struct stat& st, int accept_encoding);
+        // 获取path压缩后的内容，未命中时在当前线程中压缩，返回的条目引用计数加一，用完后调用release()
+        // 文件无法读取、压缩失败或压缩后没有变小时返回NULL，由调用者发送原文件
+        // miss不为NULL时未命中不压缩，把*miss置为true并返回NULL，调用者可以改到其他线程中再调用
+        compress_entry* acquire(const char* path, const struct stat& st, const content_encoding* encoding,
+                                bool* miss = NULL);
+        // 释放acquire()返回的条目
+        void release(compress_entry* entry);
+
+    private:
+        compress_cache();
+        ~compress_cache();
+
+        // 读取并压缩文件，失败返回NULL
+        compress_entry* load(const char* path, const struct stat& st, const content_encoding* encoding);
+        // 淘汰最久未使用的条目直到总大小不超过上限，需要持有锁
+        void shrink();
+        static void free_entry(compress_entry* entry);
+
+    private:
+        long m_min_size;
+        size_t m_max_bytes;
+        // 保护下面所有成员
+        locker m_lock;
+        std::unordered_map<std::string, compress_entry*> m_entries;
+        // 最近使用的条目在前
+        std::list<compress_entry*> m_lru;
+        // 缓存中所有条目压缩后内容的总大小
+        size_t m_bytes;
+};
+
+#endif
@@ -0,0 +1,236 @@
+#include<stdio.h>
+#include<string.h>
+#include<unistd.h>
+#include<errno.h>
+#include<fcntl.h>
+#include<pthread.h>
+#include<sys/mman.h>
+#include<sys/inotify.h>
+
+#include"file_cache.h"
+#include"../log/log.h"
+#include"../http/mime.h"
+
+// 会使缓存内容过时的目录事件：文件内容或权限改变，文件被删除、移走或被改名覆盖
+static const uint32_t WATCH_MASK = IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+                                   IN_DELETE_SELF | IN_MOVE_SELF;
+
+file_cache::file_cache(): m_max_entries(0), m_map_size(0), m_inotifyfd(-1), m_version(0) {
+}
+
+file_cache::~file_cache() {
+    for (std::list<file_entry*>::iterator it = m_lru.begin(); it != m_lru.end(); ++it) {
+        free_entry(*it);
+    }
+}
+
+// 局部静态变量单例模式
+file_cache* file_cache::get_instance() {
+    static file_cache cache;
+    return &cache;
+}
+
+bool file_cache::init(int max_entries, long map_size) {
+    m_map_size = map_size;
+    if (max_entries <= 0) {
+        return true;
+    }
+    // 无法得知文件何时改变就不能安全地缓存
+    m_inotifyfd = inotify_init1(IN_CLOEXEC);
+    if (m_inotifyfd < 0) {
+        LOG_ERROR("%s:errno is: %d", "inotify init failure, file cache disabled", errno);
+        return false;
+    }
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, watch_thread, this) != 0) {
+        close(m_inotifyfd);
+        m_inotifyfd = -1;
+        return false;
+    }
+    pthread_detach(tid);
+    m_max_entries = max_entries;
+    return true;
+}
+
+void* file_cache::watch_thread(void* arg) {
+    file_cache* cache = (file_cache*)arg;
+    cache->watch();
+    return cache;
+}
+
+void file_cache::watch() {
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    while (true) {
+        int len = read(m_inotifyfd, buf, sizeof(buf));
+        if (len < 0 && errno == EINTR) {
+            continue;
+        }
+        if (len <= 0) {
+            LOG_ERROR("%s:errno is: %d", "inotify read failure", errno);
+            break;
+        }
+        locker_RAII lock_RAII(m_lock);
+        m_version++;
+        for (char* p = buf; p < buf + len; p += sizeof(struct inotify_event) + ((struct inotify_event*)p)->len) {
+            struct inotify_event* event = (struct inotify_event*)p;
+            std::unordered_map<int, std::string>::iterator dir = m_watch_fds.find(event->wd);
+            if (dir == m_watch_fds.end()) {
+                continue;
+            }
+            if (event->len > 0) {
+                std::string path = dir->second + "/" + event->name;
+                invalidate(path);
+                // 预压缩变体的变化会改变原文件条目中记录的变体集合
+                const content_encoding* encoding = get_content_encoding(path.c_str());
+                if (encoding) {
+                    invalidate(path.substr(0, path.size() - encoding->suffix_len));
+                }
+            }
+            if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+                // 目录本身不在了，其中的文件全部失效
+                std::string prefix = dir->second + "/";
+                std::list<file_entry*>::iterator it = m_lru.begin();
+                while (it != m_lru.end()) {
+                    file_entry* entry = *it++;
+                    if (entry->path.compare(0, prefix.size(), prefix) == 0) {
+                        remove(entry);
+                    }
+                }
+                if (event->mask & IN_IGNORED) {
+                    m_watch_dirs.erase(dir->second);
+                    m_watch_fds.erase(dir);
+                }
+            }
+        }
+    }
+}
+
+file_entry* file_cache::acquire(const char* path) {
+    // 只缓存规范的路径，保证与inotify事件中的目录名和文件名拼出的路径一致
+    if (strstr(path, "//") || strstr(path, "/.")) {
+        return NULL;
+    }
+    unsigned long version;
+    {
+        locker_RAII lock_RAII(m_lock);
+        std::unordered_map<std::string, file_entry*>::iterator it = m_entries.find(path);
+        if (it != m_entries.end()) {
+            // 命中，移到LRU链表头部
+            file_entry* entry = it->second;
+            m_lru.splice(m_lru.begin(), m_lru, entry->lru);
+            entry->ref++;
+            return entry;
+        }
+        // 先监听目录再打开文件，之后的修改都会产生事件
+        std::string dir(path);
+        size_t pos = dir.rfind('/');
+        if (pos == std::string::npos) {
+            return NULL;
+        }
+        dir.resize(pos);
+        if (!add_watch(dir)) {
+            return NULL;
+        }
+        version = m_version;
+    }
+
+    // 打开文件可能要访问磁盘，不持有锁
+    file_entry* entry = load(path);
+    if (!entry) {
+        return NULL;
+    }
+
+    locker_RAII lock_RAII(m_lock);
+    if (version != m_version || m_entries.count(path)) {
+        // 打开期间目录有变化，或者其他线程已经加入了同一文件，本次打开的条目只给当前请求使用
+        return entry;
+    }
+    entry->cached = true;
+    m_lru.push_front(entry);
+    entry->lru = m_lru.begin();
+    m_entries[entry->path] = entry;
+    if ((int)m_entries.size() > m_max_entries) {
+        remove(m_lru.back());
+    }
+    return entry;
+}
+
+void file_cache::release(file_entry* entry) {
+    locker_RAII lock_RAII(m_lock);
+    if (--entry->ref == 0 && !entry->cached) {
+        free_entry(entry);
+    }
+}
+
+file_entry* file_cache::load(const char* path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat st;
+    // 与http_conn::do_request()的判断相同：其他人可读、不是目录且不为空的文件才缓存
+    if (fstat(fd, &st) < 0 || !(st.st_mode & S_IROTH) || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+    char* address = NULL;
+    if (m_map_size < 0 || st.st_size < m_map_size) {
+        void* ptr = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (ptr == MAP_FAILED) {
+            close(fd);
+            return NULL;
+        }
+        address = (char*)ptr;
+    }
+
+    file_entry* entry = new file_entry;
+    entry->path = path;
+    entry->st = st;
+    entry->fd = fd;
+    entry->address = address;
+    make_file_meta(&entry->meta, path, st);
+    entry->encodings = find_precompressed(path, st);
+    const mime_type* type = get_mime_type(path);
+    entry->header_len = snprintf(entry->header, sizeof(entry->header), "HTTP/1.1 200 OK\r\nContent-Length: %ld\r\n%s%s",
+                                 (long)st.st_size, type->header, entry->meta.headers);
+    entry->ref = 1;
+    entry->cached = false;
+    return entry;
+}
+
+bool file_cache::add_watch(const std::string& dir) {
+    if (m_watch_dirs.count(dir)) {
+        return true;
+    }
+    int wd = inotify_add_watch(m_inotifyfd, dir.c_str(), WATCH_MASK);
+    if (wd < 0) {
+        return false;
+    }
+    m_watch_dirs[dir] = wd;
+    m_watch_fds[wd] = dir;
+    return true;
+}
+
+void file_cache::invalidate(const std::string& path) {
+    std::unordered_map<std::string, file_entry*>::iterator it = m_entries.find(path);
+    if (it != m_entries.end()) {
+        remove(it->second);
+    }
+}
+
+void file_cache::remove(file_entry* entry) {
+    m_entries.erase(entry->path);
+    m_lru.erase(entry->lru);
+    entry->cached = false;
+    if (entry->ref == 0) {
+        free_entry(entry);
+    }
+}
+
+void file_cache::free_entry(file_entry* entry) {
+    if (entry->address) {
+        munmap(entry->address, entry->st.st_size);
+    }
+    close(entry->fd);
+    delete entry;
+}
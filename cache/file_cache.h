@@ -0,0 +1,92 @@
+// 静态资源缓存，缓存目标文件的文件描述符、文件属性、内存映射和预先生成的响应头
+// 以文件的完整路径为键，按LRU淘汰，由所有工作线程共享，条目带引用计数，被淘汰或失效时等最后一个使用者释放后再关闭
+// 用inotify监听被缓存文件所在的目录，文件被修改、删除或替换时使对应的条目失效
+// 命中缓存时处理静态请求不需要stat、open、mmap、close和munmap等任何文件系统调用
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include<sys/stat.h>
+#include<string>
+#include<list>
+#include<unordered_map>
+
+#include"../lock/locker.h"
+#include"../http/file_meta.h"
+
+// 缓存的一个文件
+struct file_entry {
+    // 文件的完整路径
+    std::string path;
+    // 文件属性
+    struct stat st;
+    // 只读打开的文件描述符，供sendfile使用，发送时使用各自的偏移，可以被多个连接同时使用
+    int fd;
+    // 小文件的内存映射，大文件为NULL
+    char* address;
+    // ETag等条件GET使用的元信息
+    file_meta meta;
+    // 存在的预压缩变体的编码集合，变体被创建、修改或删除时条目随之失效
+    int encodings;
+    // 预先生成的状态行、Content-Length、Content-Type和验证首部
+    char header[512];
+    int header_len;
+    // 正在使用该条目的请求数
+    int ref;
+    // 是否仍在缓存中，失效或被淘汰后为false，引用计数归零时释放
+    bool cached;
+    // 在LRU链表中的位置
+    std::list<file_entry*>::iterator lru;
+};
+
+class file_cache {
+    public:
+        // 局部静态变量单例模式
+        static file_cache* get_instance();
+
+        // 初始化，最多缓存max_entries个文件，小于map_size字节的文件同时做内存映射
+        // max_entries为0或inotify不可用时不使用缓存
+        bool init(int max_entries, long map_size);
+        bool enabled() const {
+            return m_max_entries > 0;
+        }
+        // 获取path对应的文件，未命中时打开文件并加入缓存，返回的条目引用计数加一，用完后调用release()
+        // 文件不存在、不可读、是目录或为空时返回NULL，由调用者按原来的方式处理
+        file_entry* acquire(const char* path);
+        // 释放acquire()返回的条目
+        void release(file_entry* entry);
+
+    private:
+        file_cache();
+        ~file_cache();
+
+        // inotify线程的入口函数
+        static void* watch_thread(void* arg);
+        // 读取inotify事件，使被修改的文件对应的条目失效
+        void watch();
+        // 打开文件并生成条目，失败返回NULL
+        file_entry* load(const char* path);
+        // 监听文件所在的目录，失败返回false，需要持有锁
+        bool add_watch(const std::string& dir);
+        // 使条目失效，需要持有锁
+        void invalidate(const std::string& path);
+        // 从缓存中移除条目，没有使用者时立即释放，需要持有锁
+        void remove(file_entry* entry);
+        static void free_entry(file_entry* entry);
+
+    private:
+        int m_max_entries;
+        long m_map_size;
+        // 保护下面所有成员
+        locker m_lock;
+        std::unordered_map<std::string, file_entry*> m_entries;
+        // 最近使用的条目在前
+        std::list<file_entry*> m_lru;
+        int m_inotifyfd;
+        // 目录与inotify监听描述符的对应关系
+        std::unordered_map<std::string, int> m_watch_dirs;
+        std::unordered_map<int, std::string> m_watch_fds;
+        // 每收到一个inotify事件加一，打开文件期间发生变化则不加入缓存，避免缓存已经过时的内容
+        unsigned long m_version;
+};
+
+#endif
@@ -0,0 +1,152 @@
+// 连接的读写缓冲区，平时使用对象内的小块内联缓冲区，放不下时从内存块池中取更大的内存块
+// 内存块按大小分级，用完后放回内存块池供其他连接复用，每个连接不必按最坏情况预留内存
+// 内容始终是连续的，请求解析和writev可以像使用普通数组一样使用它
+#ifndef BUFFER_H
+#define BUFFER_H
+
+#include<string.h>
+#include<stdlib.h>
+#include<vector>
+
+#include"../lock/locker.h"
+
+// 所有连接共享的内存块池，局部静态变量单例模式
+class buffer_pool {
+    public:
+        // 最小和最大的内存块大小，各级大小依次翻倍
+        static const int MIN_CHUNK_SIZE = 4096;
+        static const int MAX_CHUNK_SIZE = 65536;
+        static const int CLASS_COUNT = 5;
+        // 每一级最多保留的空闲内存块数，多余的直接释放
+        static const int MAX_FREE_CHUNKS = 256;
+
+        static buffer_pool* get_instance() {
+            static buffer_pool pool;
+            return &pool;
+        }
+
+        // 分配能容纳size字节的内存块，size改为内存块的实际大小；超过MAX_CHUNK_SIZE时返回NULL
+        // 内存块末尾多留一个字节，供请求解析在数据之后写入'\0'
+        char* alloc(int& size) {
+            int index = size_class(size);
+            if (index < 0) {
+                return NULL;
+            }
+            size = MIN_CHUNK_SIZE << index;
+            {
+                locker_RAII lock(m_lock);
+                if (!m_free[index].empty()) {
+                    char* chunk = m_free[index].back();
+                    m_free[index].pop_back();
+                    return chunk;
+                }
+            }
+            return (char*)malloc(size + 1);
+        }
+
+        // 归还alloc()分配的内存块，size为它的实际大小
+        void free(char* chunk, int size) {
+            int index = size_class(size);
+            {
+                locker_RAII lock(m_lock);
+                if ((int)m_free[index].size() < MAX_FREE_CHUNKS) {
+                    m_free[index].push_back(chunk);
+                    return;
+                }
+            }
+            ::free(chunk);
+        }
+
+    private:
+        buffer_pool() {}
+        ~buffer_pool() {
+            for (int i = 0; i < CLASS_COUNT; i++) {
+                for (size_t j = 0; j < m_free[i].size(); j++) {
+                    ::free(m_free[i][j]);
+                }
+            }
+        }
+
+        // 能容纳size字节的最小一级的下标
+        static int size_class(int size) {
+            int index = 0;
+            while (index < CLASS_COUNT && (MIN_CHUNK_SIZE << index) < size) {
+                index++;
+            }
+            return index < CLASS_COUNT ? index : -1;
+        }
+
+        locker m_lock;
+        std::vector<char*> m_free[CLASS_COUNT];
+};
+
+// INLINE_SIZE为内联缓冲区的大小，同样在末尾多留一个字节
+template <int INLINE_SIZE>
+class buffer {
+    public:
+        buffer(): m_data(m_inline), m_capacity(INLINE_SIZE) {}
+        ~buffer() {
+            shrink(0);
+        }
+
+        char* data() {
+            return m_data;
+        }
+        const char* data() const {
+            return m_data;
+        }
+        char& operator[](int index) {
+            return m_data[index];
+        }
+        int capacity() const {
+            return m_capacity;
+        }
+        bool is_inline() const {
+            return m_data == m_inline;
+        }
+
+        // 扩大到至少能容纳size字节，保留前used字节的内容，扩大后原来指向缓冲区的指针全部失效
+        // 超过最大的内存块时返回false，缓冲区保持不变
+        bool reserve(int size, int used) {
+            if (size <= m_capacity) {
+                return true;
+            }
+            char* chunk = buffer_pool::get_instance()->alloc(size);
+            if (!chunk) {
+                return false;
+            }
+            memcpy(chunk, m_data, used);
+            release_chunk();
+            m_data = chunk;
+            m_capacity = size;
+            return true;
+        }
+
+        // 前used字节的内容放得进内联缓冲区时换回内联缓冲区，内存块还给内存块池
+        void shrink(int used) {
+            if (is_inline() || used > INLINE_SIZE) {
+                return;
+            }
+            memcpy(m_inline, m_data, used);
+            release_chunk();
+            m_data = m_inline;
+            m_capacity = INLINE_SIZE;
+        }
+
+    private:
+        // 不可复制，内联缓冲区和内存块都属于这个对象
+        buffer(const buffer&);
+        buffer& operator=(const buffer&);
+
+        void release_chunk() {
+            if (!is_inline()) {
+                buffer_pool::get_instance()->free(m_data, m_capacity);
+            }
+        }
+
+        char* m_data;
+        int m_capacity;
+        char m_inline[INLINE_SIZE + 1];
+};
+
+#endif
@@ -0,0 +1,162 @@
+// 条件GET所需的文件元信息：ETag、Last-Modified以及按路径配置的Cache-Control，预压缩变体的Content-Encoding和Vary
+// 由http_conn和file_cache共用，缓存命中时直接使用预先生成的首部
+#ifndef FILE_META_H
+#define FILE_META_H
+
+#include<stdio.h>
+#include<string.h>
+#include<time.h>
+#include<sys/stat.h>
+#include<limits.h>
+#include<string>
+#include<vector>
+#include<utility>
+
+#include"mime.h"
+
+struct file_meta {
+    // 带引号的强ETag，由inode、文件大小和纳秒精度的修改时间组成，文件被替换或修改后都会改变
+    char etag[64];
+    int etag_len;
+    // ETag、Last-Modified、Accept-Ranges、Content-Encoding、Vary和Cache-Control首部行
+    char headers[320];
+    int headers_len;
+};
+
+// Cache-Control规则，按路径前缀匹配，最长的前缀优先；只能在启动时添加
+inline std::vector<std::pair<std::string, std::string> >& cache_control_rules() {
+    static std::vector<std::pair<std::string, std::string> > rules;
+    return rules;
+}
+
+// 添加一条规则，prefix为文件完整路径的前缀
+inline void add_cache_control(const std::string& prefix, const std::string& value) {
+    cache_control_rules().push_back(std::make_pair(prefix, value));
+}
+
+// 返回与路径匹配的Cache-Control取值，没有匹配的规则时返回NULL
+inline const char* get_cache_control(const char* path) {
+    const std::vector<std::pair<std::string, std::string> >& rules = cache_control_rules();
+    const char* value = NULL;
+    size_t best = 0;
+    for (size_t i = 0; i < rules.size(); i++) {
+        const std::string& prefix = rules[i].first;
+        if ((value == NULL || prefix.size() >= best) && strncmp(path, prefix.c_str(), prefix.size()) == 0) {
+            value = rules[i].second.c_str();
+            best = prefix.size();
+        }
+    }
+    return value;
+}
+
+// 根据文件属性生成元信息，encoding不为NULL时为即时压缩后的内容生成，ETag带上编码名以区别于原文件
+inline void make_file_meta(file_meta* meta, const char* path, const struct stat& st,
+                           const content_encoding* compressed = NULL) {
+    unsigned long long mtime = (unsigned long long)st.st_mtim.tv_sec * 1000000000ULL + st.st_mtim.tv_nsec;
+    meta->etag_len = snprintf(meta->etag, sizeof(meta->etag), "\"%lx-%llx-%llx%s%s\"", (unsigned long)st.st_ino,
+                              (unsigned long long)st.st_size, mtime, compressed ? "-" : "",
+                              compressed ? compressed->name : "");
+    struct tm tm;
+    gmtime_r(&st.st_mtime, &tm);
+    char date[64];
+    strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    const mime_type* type;
+    const content_encoding* encoding = split_encoding(path, &type);
+    if (!encoding) {
+        type = get_mime_type(path);
+        encoding = compressed;
+    }
+    meta->headers_len = snprintf(meta->headers, sizeof(meta->headers),
+                                 "ETag: %s\r\nLast-Modified: %s\r\nAccept-Ranges: bytes\r\n%s%s", meta->etag, date,
+                                 encoding ? encoding->header : "", type->compressible ? vary_header : "");
+    int base_len = meta->headers_len;
+    const char* cache_control = get_cache_control(path);
+    if (cache_control) {
+        meta->headers_len += snprintf(meta->headers + base_len, sizeof(meta->headers) - base_len,
+                                      "Cache-Control: %s\r\n", cache_control);
+    }
+    if (meta->headers_len >= (int)sizeof(meta->headers)) {
+        // 配置的Cache-Control过长，不发送它
+        meta->headers[base_len] = '\0';
+        meta->headers_len = base_len;
+    }
+}
+
+// 返回与path放在同一目录、可读且不旧于原文件的预压缩变体的编码集合，st为原文件的属性
+// 只为可压缩的资源查找，变体本身不再查找
+inline int find_precompressed(const char* path, const struct stat& st) {
+    if (!get_mime_type(path)->compressible || get_content_encoding(path) || st.st_size == 0) {
+        return 0;
+    }
+    char variant[PATH_MAX];
+    size_t len = strlen(path);
+    int encodings = 0;
+    for (int i = 0; i < CONTENT_ENCODING_COUNT; i++) {
+        if (len + content_encodings[i].suffix_len >= sizeof(variant)) {
+            continue;
+        }
+        memcpy(variant, path, len);
+        memcpy(variant + len, content_encodings[i].suffix, content_encodings[i].suffix_len + 1);
+        struct stat variant_st;
+        if (stat(variant, &variant_st) == 0 && S_ISREG(variant_st.st_mode) && (variant_st.st_mode & S_IROTH) &&
+            variant_st.st_size != 0 && variant_st.st_mtime >= st.st_mtime) {
+            encodings |= content_encodings[i].flag;
+        }
+    }
+    return encodings;
+}
+
+// If-None-Match使用弱比较：忽略W/前缀，列表中任意一个与etag相同即匹配，"*"匹配任何存在的文件
+inline bool etag_match(const char* list, const file_meta& meta) {
+    while (*list) {
+        list += strspn(list, " \t,");
+        if (*list == '\0') {
+            break;
+        }
+        if (*list == '*') {
+            return true;
+        }
+        if (strncmp(list, "W/", 2) == 0) {
+            list += 2;
+        }
+        int len = strcspn(list, ",");
+        int tag_len = len;
+        while (tag_len > 0 && (list[tag_len - 1] == ' ' || list[tag_len - 1] == '\t')) {
+            tag_len--;
+        }
+        if (tag_len == meta.etag_len && strncmp(list, meta.etag, tag_len) == 0) {
+            return true;
+        }
+        list += len;
+    }
+    return false;
+}
+
+// If-Modified-Since给出的时间不早于文件的修改时间时返回true，无法解析的日期视为已修改
+inline bool not_modified_since(const char* date, const struct stat& st) {
+    struct tm tm;
+    memset(&tm, '\0', sizeof(tm));
+    if (strptime(date, "%a, %d %b %Y %H:%M:%S GMT", &tm) == NULL) {
+        return false;
+    }
+    return st.st_mtime <= timegm(&tm);
+}
+
+// If-Range给出的ETag或日期与文件当前的一致时返回true，此时才按Range发送部分内容，否则发送整个文件
+// ETag使用强比较，弱ETag永远不匹配；日期必须与Last-Modified完全相同
+inline bool if_range_match(const char* value, const file_meta& meta, const struct stat& st) {
+    if (value[0] == '"') {
+        return strncmp(value, meta.etag, meta.etag_len) == 0 && value[meta.etag_len + strspn(value + meta.etag_len, " \t")] == '\0';
+    }
+    if (strncmp(value, "W/", 2) == 0) {
+        return false;
+    }
+    struct tm tm;
+    memset(&tm, '\0', sizeof(tm));
+    if (strptime(value, "%a, %d %b %Y %H:%M:%S GMT", &tm) == NULL) {
+        return false;
+    }
+    return st.st_mtime == timegm(&tm);
+}
+
+#endif
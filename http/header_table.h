@@ -0,0 +1,201 @@
+// 请求首部表，记录每个首部的名和值在读缓冲区中的位置，不复制内容
+// 常见的首部名通过编译期生成的完美哈希表映射为HEADER_ID，识别一个首部名只需要一次哈希和一次比较
+// 处理请求时按编号直接取得首部的值，各项功能不必再逐个比较首部名
+#ifndef HEADER_TABLE_H
+#define HEADER_TABLE_H
+
+#include<string.h>
+#include<strings.h>
+
+// 常见首部名的编号，与known_headers中的顺序一致
+enum HEADER_ID {
+    HEADER_HOST = 0,
+    HEADER_CONNECTION,
+    HEADER_CONTENT_LENGTH,
+    HEADER_CONTENT_TYPE,
+    HEADER_TRANSFER_ENCODING,
+    HEADER_EXPECT,
+    HEADER_IF_NONE_MATCH,
+    HEADER_IF_MODIFIED_SINCE,
+    HEADER_IF_RANGE,
+    HEADER_RANGE,
+    HEADER_ACCEPT,
+    HEADER_ACCEPT_ENCODING,
+    HEADER_ACCEPT_LANGUAGE,
+    HEADER_USER_AGENT,
+    HEADER_COOKIE,
+    HEADER_REFERER,
+    HEADER_ORIGIN,
+    HEADER_AUTHORIZATION,
+    HEADER_CACHE_CONTROL,
+    HEADER_PRAGMA,
+    HEADER_UPGRADE_INSECURE_REQUESTS,
+    HEADER_DNT,
+    HEADER_X_FORWARDED_FOR,
+    HEADER_SEC_FETCH_SITE,
+    HEADER_SEC_FETCH_MODE,
+    HEADER_SEC_FETCH_USER,
+    HEADER_SEC_FETCH_DEST,
+    HEADER_SEC_CH_UA,
+    HEADER_SEC_CH_UA_MOBILE,
+    HEADER_SEC_CH_UA_PLATFORM,
+    HEADER_COUNT,
+    // 不在上面的首部名
+    HEADER_UNKNOWN = HEADER_COUNT
+};
+
+struct known_header {
+    const char* name;
+    int len;
+};
+
+#define KNOWN_HEADER(name) {name, sizeof(name) - 1}
+static constexpr known_header known_headers[HEADER_COUNT] = {
+    KNOWN_HEADER("Host"),
+    KNOWN_HEADER("Connection"),
+    KNOWN_HEADER("Content-Length"),
+    KNOWN_HEADER("Content-Type"),
+    KNOWN_HEADER("Transfer-Encoding"),
+    KNOWN_HEADER("Expect"),
+    KNOWN_HEADER("If-None-Match"),
+    KNOWN_HEADER("If-Modified-Since"),
+    KNOWN_HEADER("If-Range"),
+    KNOWN_HEADER("Range"),
+    KNOWN_HEADER("Accept"),
+    KNOWN_HEADER("Accept-Encoding"),
+    KNOWN_HEADER("Accept-Language"),
+    KNOWN_HEADER("User-Agent"),
+    KNOWN_HEADER("Cookie"),
+    KNOWN_HEADER("Referer"),
+    KNOWN_HEADER("Origin"),
+    KNOWN_HEADER("Authorization"),
+    KNOWN_HEADER("Cache-Control"),
+    KNOWN_HEADER("Pragma"),
+    KNOWN_HEADER("Upgrade-Insecure-Requests"),
+    KNOWN_HEADER("DNT"),
+    KNOWN_HEADER("X-Forwarded-For"),
+    KNOWN_HEADER("Sec-Fetch-Site"),
+    KNOWN_HEADER("Sec-Fetch-Mode"),
+    KNOWN_HEADER("Sec-Fetch-User"),
+    KNOWN_HEADER("Sec-Fetch-Dest"),
+    KNOWN_HEADER("Sec-CH-UA"),
+    KNOWN_HEADER("Sec-CH-UA-Mobile"),
+    KNOWN_HEADER("Sec-CH-UA-Platform"),
+};
+#undef KNOWN_HEADER
+
+// 哈希表的大小，必须是2的幂
+static const int HEADER_HASH_SIZE = 64;
+
+// 由长度、首字母和最后两个字符计算哈希值，不区分大小写（首部名中只有字母、数字和'-'，或上0x20即转为小写）
+// 系数是对known_headers搜索得到的，保证所有常见首部名的哈希值互不相同；增加首部名时如果冲突，下面的static_assert会报错
+static constexpr unsigned header_hash(const char* name, int len) {
+    return (len + 15u * (name[0] | 0x20) + 2u * (name[len - 1] | 0x20) + (name[len - 2] | 0x20)) &
+           (HEADER_HASH_SIZE - 1);
+}
+
+// 哈希值到首部名编号的映射，空槽为HEADER_UNKNOWN
+struct header_slots {
+    unsigned char id[HEADER_HASH_SIZE];
+};
+
+static constexpr header_slots make_header_slots() {
+    header_slots slots = {};
+    for (int i = 0; i < HEADER_HASH_SIZE; i++) {
+        slots.id[i] = HEADER_UNKNOWN;
+    }
+    for (int i = 0; i < HEADER_COUNT; i++) {
+        slots.id[header_hash(known_headers[i].name, known_headers[i].len)] = i;
+    }
+    return slots;
+}
+
+static constexpr header_slots header_slot_table = make_header_slots();
+
+// 每个首部名都占据自己的槽，没有被后面的首部名覆盖
+static constexpr bool header_hash_is_perfect() {
+    for (int i = 0; i < HEADER_COUNT; i++) {
+        if (header_slot_table.id[header_hash(known_headers[i].name, known_headers[i].len)] != i) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static_assert(header_hash_is_perfect(), "known header names collide in header_hash, change its coefficients");
+
+// 返回首部名对应的编号，不是常见首部名时返回HEADER_UNKNOWN
+static inline HEADER_ID find_header_id(const char* name, int len) {
+    if (len < 2) {
+        return HEADER_UNKNOWN;
+    }
+    int id = header_slot_table.id[header_hash(name, len)];
+    if (id == HEADER_UNKNOWN || known_headers[id].len != len || strncasecmp(name, known_headers[id].name, len) != 0) {
+        return HEADER_UNKNOWN;
+    }
+    return (HEADER_ID)id;
+}
+
+// 一个首部的名和值在读缓冲区中的偏移和长度，读缓冲区最大64KB，用16位整数保存
+// 读缓冲区扩大时内容的偏移不变，首部表不需要调整
+struct header_field {
+    unsigned short name;
+    unsigned short name_len;
+    unsigned short value;
+    unsigned short value_len;
+    unsigned char id;
+};
+
+class header_table {
+    public:
+        // 一个请求最多记录的首部数
+        static const int MAX_HEADERS = 48;
+
+        header_table() {
+            clear();
+        }
+
+        void clear() {
+            m_count = 0;
+            memset(m_index, -1, sizeof(m_index));
+        }
+
+        // 记录一个首部，表满时返回false；同名的常见首部按编号查找时以最后一个为准
+        bool add(HEADER_ID id, int name, int name_len, int value, int value_len) {
+            if (m_count == MAX_HEADERS) {
+                return false;
+            }
+            header_field& field = m_fields[m_count];
+            field.name = name;
+            field.name_len = name_len;
+            field.value = value;
+            field.value_len = value_len;
+            field.id = id;
+            if (id != HEADER_UNKNOWN) {
+                m_index[id] = m_count;
+            }
+            m_count++;
+            return true;
+        }
+
+        // 按编号查找首部，请求中没有该首部时返回NULL
+        const header_field* find(HEADER_ID id) const {
+            return m_index[id] < 0 ? NULL : &m_fields[(int)m_index[id]];
+        }
+
+        // 按记录的顺序遍历所有首部，包括不常见的首部
+        int count() const {
+            return m_count;
+        }
+        const header_field& at(int index) const {
+            return m_fields[index];
+        }
+
+    private:
+        header_field m_fields[MAX_HEADERS];
+        int m_count;
+        // 每个常见首部在m_fields中的下标，-1表示没有
+        signed char m_index[HEADER_COUNT];
+};
+
+#endif
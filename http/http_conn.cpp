@@ -3,6 +3,14 @@
 #include<fstream>
 
 #include"http_conn.h"
+#include"mime.h"
+#include"scan.h"
+#include"router.h"
+#include"file_meta.h"
+#include"../cache/file_cache.h"
+#include"../cache/compress_cache.h"
+#include"../reactor/event_loop.h"
+#include"../threadpool/threadpool.h"
 
 // 定义HTTP响应状态
 const char* ok_200_title = "OK";
@@ -14,6 +22,41 @@ const char* error_404_title = "Not Found";
 const char* error_404_form = "The requested file was not found on this server.\n";
 const char* error_500_title = "Internet Error";
 const char* error_500_form = "There was an unusual problem serving the request file.\n";
+const char* error_503_title = "Service Unavailable";
+const char* error_503_form = "The server is too busy to handle the request, please try again later.\n";
+
+// 错误响应除Connection首部外都是固定的，启动时拼好状态行、Content-Type、Content-Length，生成响应时直接复制
+struct canned_response {
+    char header[160];
+    int header_len;
+    const char* body;
+    int body_len;
+};
+
+static canned_response make_canned_response(int status, const char* title, const char* form) {
+    canned_response response;
+    response.body = form;
+    response.body_len = strlen(form);
+    response.header_len = snprintf(response.header, sizeof(response.header),
+                                   "HTTP/1.1 %d %s\r\nContent-Type: text/plain; charset=utf-8\r\nContent-Length: %d\r\n",
+                                   status, title, response.body_len);
+    return response;
+}
+
+static const canned_response response_400 = make_canned_response(400, error_400_title, error_400_form);
+static const canned_response response_403 = make_canned_response(403, error_403_title, error_403_form);
+static const canned_response response_404 = make_canned_response(404, error_404_title, error_404_form);
+static const canned_response response_500 = make_canned_response(500, error_500_title, error_500_form);
+static const canned_response response_503 = make_canned_response(503, error_503_title, error_503_form);
+
+// multipart/byteranges的分隔符，启动时随机生成，避免与文件内容相同
+static std::string make_range_boundary() {
+    char boundary[32];
+    snprintf(boundary, sizeof(boundary), "%08lx%08lx", (unsigned long)time(NULL), (unsigned long)getpid());
+    return boundary;
+}
+
+static const std::string range_boundary = make_range_boundary();
 
 // 网站根目录
 const char* doc_root = "/home/ray/workspace/MyWebserver/root";
@@ -23,6 +66,154 @@ map<string, string> users;
 // 数据插入数据库时加锁
 locker m_lock;
 
+// 从登录和注册表单的消息体中提取用户名和密码，例如user=123&password=123
+// 消息体可能超过读缓冲区的内联大小，超长的字段被截断
+static void parse_account(const route_request& request, char* name, int name_size, char* password,
+                          int password_size) {
+    const char* body = request.body;
+    int i, j = 0;
+    for (i = 5; i < request.body_len && body[i] != '&'; i++) {
+        if (j < name_size - 1) {
+            name[j++] = body[i];
+        }
+    }
+    name[j] = '\0';
+    j = 0;
+    for (i = i + 10; i < request.body_len && body[i] != '&'; ++i) {
+        if (j < password_size - 1) {
+            password[j++] = body[i];
+        }
+    }
+    password[j] = '\0';
+}
+
+// 登录校验
+class login_handler : public route_handler {
+    public:
+        const char* handle(const route_request& request) {
+            char name[100], password[100];
+            parse_account(request, name, sizeof(name), password, sizeof(password));
+            if (users.find(name) != users.end() && users[name] == password) {
+                return "/welcome.html";
+            }
+            return "/logError.html";
+        }
+};
+
+// 注册校验，用户名不重复时插入数据库
+// 只有这里需要数据库，插入时才从数据库连接池取得连接，其他请求不占用连接
+class register_handler : public route_handler {
+    public:
+        explicit register_handler(connection_pool* conn_pool): m_conn_pool(conn_pool) {}
+        const char* handle(const route_request& request) {
+            char name[100], password[100];
+            parse_account(request, name, sizeof(name), password, sizeof(password));
+            // 检测是否重名
+            if (users.find(name) != users.end()) {
+                return "/registerError.html";
+            }
+            char sql_insert[256];
+            snprintf(sql_insert, sizeof(sql_insert), "INSERT INTO user(username, password) VALUES('%s', '%s')", name,
+                     password);
+            MYSQL* mysql = NULL;
+            connection_RAII mysql_con(&mysql, m_conn_pool);
+            // 更改数据库加锁
+            locker_RAII lock_RAII(m_lock);
+            // 插入数据库
+            int ret = mysql_query(mysql, sql_insert);
+            // 本地的map user<string, string>也更新
+            users.insert(pair<string, string>(name, password));
+            return ret ? "/registerError.html" : "/log.html";
+        }
+        // 等待数据库连接和执行INSERT都会阻塞，在数据库类的线程池中处理
+        REQUEST_CLASS request_class() const {
+            return CLASS_DB;
+        }
+
+    private:
+        connection_pool* m_conn_pool;
+};
+
+// 路径到处理器的路由，启动时由init_routes()登记，之后只读
+static router routes;
+
+void http_conn::init_routes(connection_pool* conn_pool) {
+    // 表单提交的路径对应的页面
+    static const struct {
+        const char* path;
+        const char* page;
+    } pages[] = {
+        {"/0", "/register.html"},
+        {"/1", "/log.html"},
+        {"/5", "/picture.html"},
+        {"/6", "/video.html"},
+        {"/7", "/fans.html"},
+    };
+    for (size_t i = 0; i < sizeof(pages) / sizeof(pages[0]); i++) {
+        routes.add(pages[i].path, router::ANY_METHOD, new page_handler(pages[i].page));
+    }
+    // 登录和注册只接受POST，其他方法按静态文件处理
+    routes.add("/2CGISQL.cgi", router::method_mask(POST), new login_handler);
+    routes.add("/3CGISQL.cgi", router::method_mask(POST), new register_handler(conn_pool));
+}
+
+threadpool<http_conn>* http_conn::m_class_pools[CLASS_COUNT];
+class_stats http_conn::m_class_stats[CLASS_COUNT];
+
+// 两次输出调度统计的最小间隔，单位纳秒
+static const long CLASS_REPORT_INTERVAL = 5000000000L;
+static std::atomic<long> class_report_at(0);
+
+void http_conn::set_class_pool(REQUEST_CLASS cls, threadpool<http_conn>* pool) {
+    m_class_pools[cls] = pool;
+}
+
+void http_conn::report_class_stats(long now) {
+    long last = class_report_at.load(std::memory_order_relaxed);
+    if (now - last < CLASS_REPORT_INTERVAL ||
+        !class_report_at.compare_exchange_strong(last, now, std::memory_order_relaxed)) {
+        return;
+    }
+    for (int i = 0; i < CLASS_COUNT; i++) {
+        class_stats& stats = m_class_stats[i];
+        long requests = stats.requests.exchange(0, std::memory_order_relaxed);
+        long rejected = stats.rejected.exchange(0, std::memory_order_relaxed);
+        long wait = stats.wait_ns.exchange(0, std::memory_order_relaxed);
+        long max_wait = stats.max_wait_ns.exchange(0, std::memory_order_relaxed);
+        long service = stats.service_ns.exchange(0, std::memory_order_relaxed);
+        int queued = m_class_pools[i] ? m_class_pools[i]->pending() : 0;
+        int threads = m_class_pools[i] ? m_class_pools[i]->threads() : 0;
+        // 没有活动的类别不输出
+        if (requests == 0 && rejected == 0 && queued == 0) {
+            continue;
+        }
+        long avg_wait = requests ? wait / requests / 1000 : 0;
+        long avg_service = requests ? service / requests / 1000 : 0;
+        LOG_INFO("class %s: threads %d, queued %d, requests %ld, rejected %ld, wait avg %ldus max %ldus, "
+                 "service avg %ldus", request_class_names[i], threads, queued, requests, rejected, avg_wait,
+                 max_wait / 1000, avg_service);
+        Log::get_instance()->flush();
+        printf("class %s: threads %d, queued %d, requests %ld, rejected %ld, wait avg %ldus max %ldus, "
+               "service avg %ldus\n", request_class_names[i], threads, queued, requests, rejected, avg_wait,
+               max_wait / 1000, avg_service);
+    }
+}
+
+bool http_conn::should_defer(REQUEST_CLASS cls) const {
+    return m_request_class == CLASS_STATIC && cls != CLASS_STATIC && m_class_pools[cls] != NULL;
+}
+
+bool http_conn::schedule(REQUEST_CLASS cls) {
+    m_request_class = cls;
+    mark_queued();
+    if (m_class_pools[cls]->append(this)) {
+        return true;
+    }
+    m_request_class = CLASS_STATIC;
+    m_class_stats[cls].rejected.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
 void http_conn::initmysql_result(connection_pool* conn_pool) {
     // 从数据库池中获取一个数据库连接
     MYSQL* mysql = nullptr;
@@ -85,28 +276,40 @@ void modfd(int epollfd, int fd, int ev) {
 }
 
 // 类的静态成员在类内声明，类外定义,定义不用加static
-// static int m_epollfd;
-int http_conn::m_user_count = 0;
-int http_conn::m_epollfd = -1;
+// static int m_user_count;
+std::atomic<int> http_conn::m_user_count(0);
+// 小文件mmap后一次writev就能连同响应头一起发出；大文件用sendfile在内核中直接从页缓存发送，不占用进程的地址空间
+long http_conn::m_sendfile_threshold = 16384;
 
-// 关闭连接
-void http_conn::close_conn(bool real_close) {
-    if (real_close && (m_sockfd != -1)) {
-        removefd(m_epollfd, m_sockfd);
-        m_sockfd = -1;
-        // 关闭连接，客户数量减一
-        m_user_count--;
+// 重新监听socket上的事件
+void http_conn::rearm(int ev) {
+    if (m_epollfd != -1) {
+        modfd(m_epollfd, m_sockfd, ev);
+        clear_busy();
+    } else {
+        m_loop->rearm(m_sockfd, m_conn_gen, ev);
     }
 }
 
+void http_conn::request_close() {
+    m_loop->close_later(m_sockfd, m_conn_gen);
+}
+
 // 初始化新接受的连接
-void http_conn::init(int sockfd, const sockaddr_in &addr) {
+void http_conn::init(int sockfd, const sockaddr_in &addr, int epollfd, event_loop* loop, unsigned gen) {
+    m_epollfd = epollfd;
+    m_loop = loop;
+    m_conn_gen = gen;
+    m_io_task = IO_NONE;
+    m_busy.store(0, std::memory_order_relaxed);
     m_sockfd = sockfd;
     m_address = addr;
     // 如下两行是为了避免TIME_WAIT状态，仅用于调试，实际使用时应该去掉
     // int reuse = 1;
     // setsockopt(m_sockfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
-    addfd(m_epollfd, sockfd, true);
+    if (m_epollfd != -1) {
+        addfd(m_epollfd, sockfd, true);
+    }
     m_user_count++;
     init();
 }
@@ -114,9 +317,22 @@ void http_conn::init(int sockfd, const sockaddr_in &addr) {
 // 初始化连接
 // init() 是 private 函数，被 public 函数 init(int, const sockaddr_in) 调用
 void http_conn::init() {
-    mysql = nullptr;
-    bytes_to_send = 0;
-    bytes_have_send = 0;
+    m_request_class = CLASS_STATIC;
+    m_queued_at = class_clock_ns();
+    reset_request();
+    release_buffers();
+    // memset() 常用于内存空间的初始化
+    memset(m_read_buf.data(), '\0', READ_BUFFER_SIZE);
+    memset(m_write_buf.data(), '\0', WRITE_BUFFER_SIZE);
+}
+
+void http_conn::release_buffers() {
+    reset_response();
+    m_read_idx = 0;
+    m_read_buf.shrink(0);
+}
+
+void http_conn::reset_request() {
     cgi = 0;
 
     m_checked_state = CHECK_STATE_REQUESTLINE;
@@ -125,63 +341,151 @@ void http_conn::init() {
     m_url = 0;
     m_version = 0;
     m_content_length = 0;
-    m_host = 0;
+    m_headers.clear();
+    m_accept_encoding = 0;
+    m_range_count = 0;
     m_start_line = 0;
     m_checked_idx = 0;
-    m_read_idx = 0;
-    m_write_idx = 0;
-    // memset() 常用于内存空间的初始化
-    memset(m_read_buf, '\0', READ_BUFFER_SIZE);
-    memset(m_write_buf, '\0', WRITE_BUFFER_SIZE);
+    m_request_end = 0;
+    m_string = 0;
     memset(m_real_file, '\0', FILENAME_MAX_LEN);
 }
 
+void http_conn::reset_response() {
+    bytes_to_send = 0;
+    bytes_have_send = 0;
+    m_write_idx = 0;
+    m_iv_count = 0;
+    m_iv_idx = 0;
+    m_write_linger = false;
+    // 响应都已发出，扩大过的写缓冲区还给内存块池
+    m_write_buf.shrink(0);
+}
+
+// 请求的各个字段都指向读缓冲区，所以要等响应生成之后才能移动剩余数据
+void http_conn::next_request() {
+    int rest = m_read_idx - m_request_end;
+    if (rest > 0) {
+        if (m_checked_state == CHECK_STATE_CONTENT) {
+            m_read_buf[m_request_end] = m_request_end_char;
+        }
+        memmove(m_read_buf.data(), m_read_buf.data() + m_request_end, rest);
+        m_read_idx = rest;
+    } else {
+        m_read_idx = 0;
+    }
+    // 大请求处理完后，剩余数据放得进内联缓冲区时不再占用内存块
+    m_read_buf.shrink(m_read_idx);
+    reset_request();
+}
+
+// 前面的响应都是内存中的数据，最后一个响应才可能用sendfile发送文件
+bool http_conn::can_pipeline() const {
+    return m_write_linger && m_read_idx > 0 && m_file_fd == -1 && m_held_count < MAX_PIPELINE - 1 &&
+           m_iv_count + MAX_IOV <= WRITE_IOV_SIZE && MAX_WRITE_BUFFER_SIZE - m_write_idx > RESPONSE_BUFFER_SIZE;
+}
+
+// 消息体的长度已知时一次扩大到能放下整个请求，否则扩大一级
+bool http_conn::grow_read_buffer() {
+    long size = m_read_idx + 1;
+    if (m_checked_state == CHECK_STATE_CONTENT && (long)m_checked_idx + m_content_length > size) {
+        size = (long)m_checked_idx + m_content_length;
+    }
+    if (size > MAX_READ_BUFFER_SIZE) {
+        return false;
+    }
+    char* old = m_read_buf.data();
+    if (!m_read_buf.reserve(size, m_read_idx)) {
+        return false;
+    }
+    // 请求行中解析出的字段指向原来的读缓冲区，首部表记录的是偏移，不需要调整
+    char** fields[] = {&m_url, &m_version};
+    for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+        if (*fields[i]) {
+            *fields[i] = m_read_buf.data() + (*fields[i] - old);
+        }
+    }
+    return true;
+}
+
+bool http_conn::reserve_write(int len) {
+    if (m_write_idx + len <= m_write_buf.capacity()) {
+        return true;
+    }
+    char* old = m_write_buf.data();
+    if (m_write_idx + len > MAX_WRITE_BUFFER_SIZE || !m_write_buf.reserve(m_write_idx + len, m_write_idx)) {
+        return false;
+    }
+    // 流水线中前面的响应头已经作为数据块加入m_iv，指向原来的写缓冲区
+    for (int i = 0; i < m_iv_count; i++) {
+        char* base = (char*)m_iv[i].iov_base;
+        if (base >= old && base <= old + m_write_idx) {
+            m_iv[i].iov_base = m_write_buf.data() + (base - old);
+        }
+    }
+    return true;
+}
+
+void http_conn::hold_file() {
+    if (!m_file_address && !m_file_entry && !m_compressed) {
+        return;
+    }
+    held_file& held = m_held[m_held_count++];
+    held.address = m_file_address;
+    held.size = m_file_stat.st_size;
+    held.entry = m_file_entry;
+    held.compressed = m_compressed;
+    m_file_address = 0;
+    m_file_entry = NULL;
+    m_compressed = NULL;
+}
+
 // 从状态机，用于分析出每一行内容
 // 返回值为行的读取状态：LINE_OK, LINE_BAD, LINE_OPEN
 http_conn::LINE_STATUS http_conn::parse_line() {
-    char temp;
+    char* buf = m_read_buf.data();
     // m_checked_idx指向buffer中当前正在分析的字节
     // m_read_idx指向buffer中客户数据的尾部的下一字节
-    for (; m_checked_idx < m_read_idx; ++m_checked_idx) {
-        // 当前分析的字节
-        temp = m_read_buf[m_checked_idx];
-        // 判断HTTP请求头部结束的依据是遇到一个空行，仅包含一对回车换行符
-        // 如果当前字节是回车符，说明有可能读取到一个完整的行
-        if (temp == '\r') {
-            // 如果回车符恰巧是buffer中最后一个已被读入的客户数据，说明没有读到一个完整的行
-            // 返回LINE_OPEN以表示需要继续读客户数据
-            if ((m_checked_idx + 1) == m_read_idx) {
-                return LINE_OPEN;
-            } else if (m_read_buf[m_checked_idx + 1] == '\n') {
-                // 如果下一个字符数换行符，说明成功读取到一个完整的行
-                m_read_buf[m_checked_idx++] = '\0';
-                m_read_buf[m_checked_idx++] = '\0';
-                return LINE_OK;
-            }
-            // 否则说明客户发送的HTTP请求存在问题
-            return LINE_BAD;
-        } else if (temp == '\n') {
-            // 如果当前字节是换行符，说明也可能读取到一个完整的行
-            // 如果上一个字节是回车符，说明成功读取到一个完整的行
-            if ((m_checked_idx > 1) && (m_read_buf[m_checked_idx - 1] == '\r')) {
-                m_read_buf[m_checked_idx - 1] = '\0';
-                m_read_buf[m_checked_idx++] = '\0';
-                return LINE_OK;
-            }
-            return LINE_BAD;
-        }
-    }
-    // 需要继续读取数据才能进一步分析
-    return LINE_OPEN;
+    // 一次比较多个字节，直接跳到下一个回车符或换行符
+    m_checked_idx = scan_line_end(buf + m_checked_idx, buf + m_read_idx) - buf;
+    if (m_checked_idx == m_read_idx) {
+        // 需要继续读取数据才能进一步分析
+        return LINE_OPEN;
+    }
+    // 判断HTTP请求头部结束的依据是遇到一个空行，仅包含一对回车换行符
+    // 如果当前字节是回车符，说明有可能读取到一个完整的行
+    if (buf[m_checked_idx] == '\r') {
+        // 如果回车符恰巧是buffer中最后一个已被读入的客户数据，说明没有读到一个完整的行
+        // 返回LINE_OPEN以表示需要继续读客户数据
+        if ((m_checked_idx + 1) == m_read_idx) {
+            return LINE_OPEN;
+        } else if (buf[m_checked_idx + 1] == '\n') {
+            // 如果下一个字符数换行符，说明成功读取到一个完整的行
+            buf[m_checked_idx++] = '\0';
+            buf[m_checked_idx++] = '\0';
+            return LINE_OK;
+        }
+        // 否则说明客户发送的HTTP请求存在问题
+        return LINE_BAD;
+    }
+    // 如果当前字节是换行符，说明也可能读取到一个完整的行
+    // 如果上一个字节是回车符，说明成功读取到一个完整的行
+    if ((m_checked_idx > 1) && (buf[m_checked_idx - 1] == '\r')) {
+        buf[m_checked_idx - 1] = '\0';
+        buf[m_checked_idx++] = '\0';
+        return LINE_OK;
+    }
+    return LINE_BAD;
 }
 
 // 解析HTTP请求行，获得请求方法、目标URL以及HTTP版本号
-http_conn::HTTP_CODE http_conn::parse_request_line(char* text) {
-    // char *strpbrk(const char *str1, const char *str2) 检索字符串str1中第一个匹配字符串str2中字符的字符
-    // 并返回该字符位置
-    m_url = strpbrk(text, " \t");
+// len为请求行的长度，按长度向量化查找分隔符，不必再逐字节扫描
+http_conn::HTTP_CODE http_conn::parse_request_line(char* text, int len) {
+    char* end = text + len;
+    // 查找第一个空白字符的位置
+    m_url = scan_space(text, end);
     // 如果请求行中没有空白字符或者'\t'字符，请求行有问题
-    if (!m_url) {
+    if (m_url == end) {
         printf("url error.\n");
         return BAD_REQUEST;
     }
@@ -198,15 +502,14 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char* text) {
         printf("method error.\n");
         return BAD_REQUEST;
     }
-    // size_t strspn(const char *str1, const char *str2) 检索字符串str1中第一个不在字符串str2中出现的字符下标
-    m_url += strspn(m_url, " \t");
-    m_version = strpbrk(m_url, " \t");
-    if (!m_version) {
+    m_url = skip_space(m_url, end);
+    m_version = scan_space(m_url, end);
+    if (m_version == end) {
         printf("version error.\n");
         return BAD_REQUEST;
     }
     *m_version++ = '\0';
-    m_version += strspn(m_version, " \t");
+    m_version = skip_space(m_version, end);
     // 仅支持HTTP/1.1
     if (strncasecmp(m_version, "HTTP/1.1", 8) != 0) {
         printf("url error: only HTTP/1.1\n");
@@ -235,38 +538,70 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char* text) {
     return NO_REQUEST;
 }
 
-// 解析HTTP请求的头部信息
-http_conn::HTTP_CODE http_conn::parse_headers(char* text) {
+// 解析HTTP请求的头部信息，len为该行的长度
+// 每个首部都记入首部表，服务器自己要用的几个首部同时解析出它们的值
+http_conn::HTTP_CODE http_conn::parse_headers(char* text, int len) {
     // 空行说明头部字段解析完毕
-    if (text[0] == '\0') {
+    if (len == 0) {
         // 如果HTTP请求有消息体，则还需要读取m_content_length字节的消息体
         // 状态机转移到CHECK_STATE_CONTENT
         if (m_content_length != 0) {
+            // 整个请求必须放得下读缓冲区，消息体从m_checked_idx开始
+            if (m_content_length > MAX_READ_BUFFER_SIZE - m_checked_idx) {
+                m_linger = false;
+                return BAD_REQUEST;
+            }
             m_checked_state = CHECK_STATE_CONTENT;
             return NO_REQUEST;
         }
         // 否则说明以及得到了一个完整的HTTP请求
         return GET_REQUEST;
-    } else if (strncasecmp(text, "Connection:", 11) == 0) {
-        // 处理connection头部字段
-        text += 11;
-        text += strspn(text, "\t");
-        // 是否持续连接
-        if (strcasecmp(text, "keep-alive") == 0) {
-            m_linger = true;
-        }
-    } else if (strncasecmp(text, "Content-Length:", 15) == 0) {
-        // 处理Content-Length头部字段
-        text += 15;
-        text += strspn(text, "\t");
-        m_content_length = atol(text);
-    } else if (strncasecmp(text, "Host:", 5) == 0) {
-        text += 5;
-        text += strspn(text, "\t");
-        m_host = text;
-    } else {
-        LOG_INFO("unknow header %s", text);
-        Log::get_instance()->flush();
+    }
+    // 一次查找得到首部名的长度和首部值的起始位置，没有冒号时首部值为空
+    char* end = text + len;
+    char* colon = scan_colon(text, end);
+    int name_len = colon - text;
+    char* value = skip_space(colon + (colon < end), end);
+    // 去掉首部值末尾的空白，首部值仍以'\0'结尾
+    while (end > value && (end[-1] == ' ' || end[-1] == '\t')) {
+        *--end = '\0';
+    }
+    HEADER_ID id = find_header_id(text, name_len);
+    char* buf = m_read_buf.data();
+    if (!m_headers.add(id, text - buf, name_len, value - buf, end - value)) {
+        // 首部过多
+        m_linger = false;
+        return BAD_REQUEST;
+    }
+    switch (id) {
+        case HEADER_CONNECTION: {
+            // 是否持续连接
+            m_linger = strcasecmp(value, "keep-alive") == 0;
+            break;
+        }
+        case HEADER_CONTENT_LENGTH: {
+            // 只接受十进制数字，负数、带符号、有多余字符或溢出的长度都会让消息体的边界算错
+            char* tail;
+            long length = strtol(value, &tail, 10);
+            if (*value < '0' || *value > '9' || *tail != '\0' || length > MAX_READ_BUFFER_SIZE) {
+                m_linger = false;
+                return BAD_REQUEST;
+            }
+            m_content_length = length;
+            break;
+        }
+        case HEADER_TRANSFER_ENCODING: {
+            // 不支持分块传输，无法确定消息体的结束位置，流水线中会把消息体当成下一个请求
+            m_linger = false;
+            return BAD_REQUEST;
+        }
+        case HEADER_ACCEPT_ENCODING: {
+            m_accept_encoding = parse_accept_encoding(value);
+            break;
+        }
+        default: {
+            break;
+        }
     }
     return NO_REQUEST;
 }
@@ -274,6 +609,8 @@ http_conn::HTTP_CODE http_conn::parse_headers(char* text) {
 // 并没有真正解析HTTP请求的消息体，只是判断它是否被完整的读入了
 http_conn::HTTP_CODE http_conn::parse_content(char* text) {
     if (m_read_idx >= (m_content_length + m_checked_idx)) {
+        // 消息体之后可能紧跟着流水线中的下一个请求
+        m_request_end_char = text[m_content_length];
         text[m_content_length] = '\0';
         m_string = text;
         return GET_REQUEST;
@@ -290,23 +627,29 @@ http_conn::HTTP_CODE http_conn::process_read() {
     while (((m_checked_state == CHECK_STATE_CONTENT) && (line_status == LINE_OK))
         || ((line_status = parse_line()) == LINE_OK)) {
             text = get_line();
+            // 完整的行以两个'\0'结尾，行的长度由从状态机的位置直接算出
+            int line_len = m_checked_idx - 2 - m_start_line;
             m_start_line = m_checked_idx;
             LOG_INFO("%s", text);
             Log::get_instance()->flush();
 
             switch(m_checked_state) {
                 case CHECK_STATE_REQUESTLINE: {
-                    ret = parse_request_line(text);
+                    ret = parse_request_line(text, line_len);
                     if (ret == BAD_REQUEST) {
+                        // 无法确定错误请求的结束位置，响应后关闭连接
+                        m_linger = false;
                         return BAD_REQUEST;
                     }
                     break;
                 }
                 case CHECK_STATE_HEADER: {
-                    ret = parse_headers(text);
+                    ret = parse_headers(text, line_len);
                     if (ret == BAD_REQUEST) {
+                        m_linger = false;
                         return BAD_REQUEST;
                     } else if (ret == GET_REQUEST) {
+                        m_request_end = m_checked_idx;
                         return do_request();
                     }
                     break;
@@ -314,12 +657,14 @@ http_conn::HTTP_CODE http_conn::process_read() {
                 case CHECK_STATE_CONTENT: {
                     ret = parse_content(text);
                     if (ret == GET_REQUEST) {
+                        m_request_end = m_checked_idx + m_content_length;
                         return do_request();
                     }
-                    line_status = LINE_OPEN;
-                    break;
+                    // 消息体还不完整，不能再用parse_line()扫描消息体，否则m_checked_idx会越过消息体的起始位置
+                    return NO_REQUEST;
                 }
                 default: {
+                    m_linger = false;
                     return INTERNAL_ERROR;
                 }
             }
@@ -329,113 +674,73 @@ http_conn::HTTP_CODE http_conn::process_read() {
 
 // 当得到一个完整正确的HTTP请求时，我们就分析目标文件的属性，如果目标文件存在
 // 并且可读，且不是目录，就用mmap将其映射到内存地址 m_file_address 处，并返回成功获取文件
+// 大文件不做映射，保留文件描述符 m_file_fd 由write()用sendfile发送
+// 开启静态资源缓存时先查找缓存，命中则直接使用缓存的文件属性、映射和文件描述符
 http_conn::HTTP_CODE http_conn::do_request() {
     strcpy(m_real_file, doc_root);
     int len = strlen(doc_root);
-    // strncpy(m_real_file + len, m_url, FILENAME_MAX_LEN - len - 1);
     printf("m_url: %s\n", m_url);
-    // strcpy(m_real_file, m_url + 1);
-    // char *strrchr(const char *str, int c) 在参数str所指向的字符串中搜索最后一次出现字符c（一个无符号字符）的位置
-    const char* p = strrchr(m_url, '/');
-    // 0跳转注册页面，GET
-    // 1跳转登录页面，GET
-    // 2登录校验
-    // 3注册校验
-    // 5显示图片页面，POST
-    // 6显示视频页面，POST
-    // 7显示关注页面，POST
-    // 处理cgi
-    if (cgi == 1 && (*(p + 1) == '2' || *(p + 1) == '3')) {
-        // 根据标志判断是登录检测还是注册检测
-        char flag = m_url[1];
-        char* m_url_real = (char*)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/");
-        strcat(m_url_real, m_url + 2);
-        strncpy(m_real_file + len, m_url_real, FILENAME_MAX_LEN - len - 1);
-        // malloc()后free()
-        free(m_url_real);
-
-        // 提取用户名和密码
-        // user=123&password=123
-        char name[100], password[100];
-        int i;
-        for (i = 5; m_string[i] != '&'; i++)
-            name[i - 5] = m_string[i];
-        name[i - 5] = '\0';
-        int j = 0;
-        for (i = i + 10; m_string[i] != '\0'; ++i, ++j)
-            password[j] = m_string[i];
-        password[j] = '\0';
-
-        // 注册校验
-        if (*(p + 1) == '3') {
-            char* sql_insert = (char*)malloc(sizeof(char) * 200);
-            strcpy(sql_insert, "INSERT INTO user(username, password) VALUES(");
-            strcat(sql_insert, "'");
-            strcat(sql_insert, name);
-            strcat(sql_insert, "', '");
-            strcat(sql_insert, password);
-            strcat(sql_insert, "')");
-            // 检测是否重名
-            if (users.find(name) == users.end()) {
-                // 更改数据库加锁
-                locker_RAII lock_RAII(m_lock);
-                // 插入数据库
-                int ret = mysql_query(mysql, sql_insert);
-                // 本地的map user<string, string>也更新
-                users.insert(pair<string, string>(name, password));
-
-                if (!ret) {
-                    strcpy(m_url, "/log.html");
-                } else {
-                    strcpy(m_url, "/registerError.html");
-                }
-            } else {
-                strcpy(m_url, "/registerError.html");
+    // 由路由找到处理器，得到要发送的文件，没有登记的路径按静态文件处理
+    route_request request;
+    request.method = m_method;
+    request.url = m_url;
+    request.body = m_string;
+    request.body_len = m_string ? m_content_length : 0;
+    route_handler* handler = routes.find(m_url, m_method);
+    // 会阻塞的处理器交给对应类别的线程池，在那里重新执行do_request()
+    REQUEST_CLASS cls = handler->request_class();
+    if (should_defer(cls)) {
+        m_request_class = cls;
+        return DEFERRED_REQUEST;
+    }
+    const char* target = handler->handle(request);
+    strncpy(m_real_file + len, target, FILENAME_MAX_LEN - len - 1);
+    m_real_file[FILENAME_MAX_LEN - 1] = '\0';
+
+    // sendfile由write()完成，io_uring引擎没有epoll内核事件表，由事件循环通过get_iov()发送映射的内存
+    bool use_sendfile = (m_epollfd != -1 && m_sendfile_threshold >= 0);
+    file_cache* cache = file_cache::get_instance();
+    if (cache->enabled() && (m_file_entry = cache->acquire(m_real_file)) != NULL) {
+        if (m_file_entry->encodings & m_accept_encoding) {
+            // 改为发送客户端接受的预压缩变体，变体不可用时仍发送原文件
+            int len = strlen(m_real_file);
+            file_entry* variant = NULL;
+            if (append_encoding_suffix(m_real_file, FILENAME_MAX_LEN, m_file_entry->encodings & m_accept_encoding)) {
+                variant = cache->acquire(m_real_file);
             }
-        // 如果是登录，直接判断
-        } else if (*(p + 1) == '2') {
-            if (users.find(name) != users.end() && users[name] == password) {
-                strcpy(m_url, "/welcome.html");
+            if (variant) {
+                cache->release(m_file_entry);
+                m_file_entry = variant;
             } else {
-                strcpy(m_url, "/logError.html");
-            }
-        }
-    }
-
-    if (*(p + 1) == '0') {
-        char* m_url_real = (char*)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/register.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
-        // malloc()后free()
-        free(m_url_real);
-    } else if (*(p + 1) == '1') {
-        char* m_url_real = (char*)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/log.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
-        // malloc()后free()
-        free(m_url_real);
-    } else if (*(p + 1) == '5') {
-        char* m_url_real = (char*)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/picture.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
-        // malloc()后free()
-        free(m_url_real);
-    } else if (*(p + 1) == '6') {
-        char* m_url_real = (char*)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/video.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
-        // malloc()后free()
-        free(m_url_real);
-    } else if (*(p + 1) == '7') {
-        char* m_url_real = (char*)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/fans.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
-        // malloc()后free()
-        free(m_url_real);
-    } else {
-        strncpy(m_real_file + len, m_url, FILENAME_MAX_LEN - len - 1);
-        // strcpy(m_real_file + len, m_url + 1);
+                m_real_file[len] = '\0';
+            }
+        }
+        m_file_stat = m_file_entry->st;
+        HTTP_CODE ret;
+        if (compress_file(&ret)) {
+            cache->release(m_file_entry);
+            m_file_entry = NULL;
+            return ret;
+        }
+        // 304和416响应都不需要文件内容，保留缓存条目，使用其中预先生成的验证首部
+        ret = check_conditions(m_file_entry->meta);
+        if (ret != FILE_REQUEST) {
+            return ret;
+        }
+        if (use_sendfile && m_file_stat.st_size >= m_sendfile_threshold) {
+            m_file_fd = m_file_entry->fd;
+        } else if (m_file_entry->address) {
+            m_file_address = m_file_entry->address;
+        } else {
+            // 缓存只映射小文件，io_uring引擎发送大文件时单独映射
+            m_file_address = (char*)mmap(0, m_file_stat.st_size, PROT_READ, MAP_PRIVATE, m_file_entry->fd, 0);
+            if (m_file_address == MAP_FAILED) {
+                m_file_address = 0;
+                unmap();
+                return INTERNAL_ERROR;
+            }
+        }
+        return FILE_REQUEST;
     }
 
     if (stat(m_real_file, &m_file_stat) < 0) {
@@ -449,32 +754,226 @@ http_conn::HTTP_CODE http_conn::do_request() {
     if (S_ISDIR(m_file_stat.st_mode)) {
         return BAD_REQUEST;
     }
+    int encodings = m_accept_encoding ? find_precompressed(m_real_file, m_file_stat) & m_accept_encoding : 0;
+    if (encodings) {
+        // 改为发送客户端接受的预压缩变体
+        int len = strlen(m_real_file);
+        struct stat variant_stat;
+        if (append_encoding_suffix(m_real_file, FILENAME_MAX_LEN, encodings) && stat(m_real_file, &variant_stat) == 0) {
+            m_file_stat = variant_stat;
+        } else {
+            m_real_file[len] = '\0';
+        }
+    }
+    HTTP_CODE ret;
+    if (compress_file(&ret)) {
+        return ret;
+    }
+    // 条件请求和Range在打开文件之前判断，文件未修改或范围无法满足时不必打开
+    if ((get_header(HEADER_IF_NONE_MATCH) || get_header(HEADER_IF_MODIFIED_SINCE) || get_header(HEADER_RANGE)) &&
+        m_file_stat.st_size != 0) {
+        file_meta meta;
+        make_file_meta(&meta, m_real_file, m_file_stat);
+        ret = check_conditions(meta);
+        if (ret != FILE_REQUEST) {
+            return ret;
+        }
+    }
     // 以只读的方式打开
     int fd = open(m_real_file, O_RDONLY);
+    if (fd < 0) {
+        return NO_RESOURCE;
+    }
+    // 空文件没有内容可以映射，mmap长度为0时会失败
+    if (m_file_stat.st_size == 0) {
+        close(fd);
+        return FILE_REQUEST;
+    }
+    if (use_sendfile && m_file_stat.st_size >= m_sendfile_threshold) {
+        m_file_fd = fd;
+        return FILE_REQUEST;
+    }
     // mmap映射到内存中
     m_file_address = (char*)mmap(0, m_file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
     close(fd);
     return FILE_REQUEST;
 }
 
-// 封装取消映射函数
+// Range针对的是压缩后的内容，带Range首部的请求不压缩，发送原文件
+// 压缩缓存没有命中时需要即时压缩，有CPU类的线程池时交给它处理
+bool http_conn::compress_file(HTTP_CODE* ret) {
+    if (!m_accept_encoding || get_header(HEADER_RANGE)) {
+        return false;
+    }
+    compress_cache* cache = compress_cache::get_instance();
+    const content_encoding* encoding = cache->select(m_real_file, m_file_stat, m_accept_encoding);
+    if (!encoding) {
+        return false;
+    }
+    bool miss = false;
+    m_compressed = cache->acquire(m_real_file, m_file_stat, encoding, should_defer(CLASS_CPU) ? &miss : NULL);
+    if (miss) {
+        m_request_class = CLASS_CPU;
+        *ret = DEFERRED_REQUEST;
+        return true;
+    }
+    if (!m_compressed) {
+        return false;
+    }
+    m_file_address = m_compressed->data;
+    m_file_stat.st_size = m_compressed->len;
+    *ret = check_conditions(m_compressed->meta);
+    return true;
+}
+
+http_conn::HTTP_CODE http_conn::check_conditions(const file_meta& meta) {
+    if (check_not_modified(meta)) {
+        return NOT_MODIFIED;
+    }
+    int count = parse_range(meta);
+    if (count == 0) {
+        return RANGE_NOT_SATISFIABLE;
+    }
+    m_range_count = count > 0 ? count : 0;
+    return FILE_REQUEST;
+}
+
+// If-None-Match优先，没有时才看If-Modified-Since
+bool http_conn::check_not_modified(const file_meta& meta) {
+    if (m_method != GET) {
+        return false;
+    }
+    const char* if_none_match = get_header(HEADER_IF_NONE_MATCH);
+    if (if_none_match) {
+        return etag_match(if_none_match, meta);
+    }
+    const char* if_modified_since = get_header(HEADER_IF_MODIFIED_SINCE);
+    if (if_modified_since) {
+        return not_modified_since(if_modified_since, m_file_stat);
+    }
+    return false;
+}
+
+// 支持bytes=a-b、bytes=a-和bytes=-n三种形式及它们用逗号分隔的组合
+// 格式错误、范围过多或If-Range不匹配时忽略Range首部；超出文件末尾的范围被截断，完全在文件之外的范围被丢弃
+int http_conn::parse_range(const file_meta& meta) {
+    const char* range = get_header(HEADER_RANGE);
+    if (!range || m_method != GET) {
+        return -1;
+    }
+    const char* if_range = get_header(HEADER_IF_RANGE);
+    if (if_range && !if_range_match(if_range, meta, m_file_stat)) {
+        return -1;
+    }
+    if (strncasecmp(range, "bytes=", 6) != 0) {
+        return -1;
+    }
+    off_t size = m_file_stat.st_size;
+    const char* p = range + 6;
+    int specs = 0;
+    int count = 0;
+    while (true) {
+        p += strspn(p, " \t,");
+        if (*p == '\0') {
+            break;
+        }
+        specs++;
+        off_t start;
+        off_t end;
+        char* tail;
+        if (*p == '-') {
+            // 最后n个字节
+            if (*++p < '0' || *p > '9') {
+                return -1;
+            }
+            off_t suffix = strtoll(p, &tail, 10);
+            start = suffix < size ? size - suffix : 0;
+            end = suffix > 0 ? size - 1 : -1;
+        } else if (*p >= '0' && *p <= '9') {
+            start = strtoll(p, &tail, 10);
+            if (*tail++ != '-') {
+                return -1;
+            }
+            end = size - 1;
+            if (*tail >= '0' && *tail <= '9') {
+                end = strtoll(tail, &tail, 10);
+                if (end < start) {
+                    return -1;
+                }
+                if (end >= size) {
+                    end = size - 1;
+                }
+            }
+        } else {
+            return -1;
+        }
+        p = tail + strspn(tail, " \t");
+        if (*p != '\0' && *p != ',') {
+            return -1;
+        }
+        if (start > end || start >= size) {
+            // 不可满足的范围
+            continue;
+        }
+        if (count == MAX_RANGES) {
+            return -1;
+        }
+        m_range_start[count] = start;
+        m_range_end[count] = end;
+        count++;
+    }
+    return specs > 0 ? count : -1;
+}
+
+void http_conn::add_cache_control(const char* path, const char* value) {
+    ::add_cache_control(std::string(doc_root) + path, value);
+}
+
+// 封装取消映射函数，sendfile发送的文件则关闭文件描述符
+// 属于缓存条目的映射和文件描述符由缓存释放，连接只归还对条目的引用
+// 释放一个响应的文件，缓存条目和压缩结果中的内容由缓存负责释放
+static void release_file(char* address, off_t size, file_entry* entry, compress_entry* compressed) {
+    if (address && !compressed && (!entry || address != entry->address)) {
+        munmap(address, size);
+    }
+    if (entry) {
+        file_cache::get_instance()->release(entry);
+    }
+    if (compressed) {
+        compress_cache::get_instance()->release(compressed);
+    }
+}
+
 void http_conn::unmap() {
-    if (m_file_address) {
-        munmap(m_file_address, m_file_stat.st_size);
-        m_file_address = 0;
+    while (m_held_count > 0) {
+        held_file& held = m_held[--m_held_count];
+        release_file(held.address, held.size, held.entry, held.compressed);
+    }
+    if (m_file_fd != -1) {
+        if (!m_file_entry) {
+            close(m_file_fd);
+        }
+        m_file_fd = -1;
     }
+    release_file(m_file_address, m_file_stat.st_size, m_file_entry, m_compressed);
+    m_file_address = 0;
+    m_file_entry = NULL;
+    m_compressed = NULL;
 }
 
 // 循环读取客户数据，直到无数据可读或对方关闭连接
 // 非阻塞ET模式下，需要一次性将数据读完
 bool http_conn::read() {
-    if (m_read_idx >= READ_BUFFER_SIZE) {
+    int capacity = m_read_buf.capacity();
+    if (m_read_idx >= capacity) {
         return false;
     }
     // 本轮读到的字节数
     int bytes_read = 0;
-    while (true) {
-        bytes_read = recv(m_sockfd, m_read_buf + m_read_idx, READ_BUFFER_SIZE - m_read_idx, 0);
+    // 流水线中的请求可能超过读缓冲区，读满后先处理已经读到的请求，其余数据留在socket中
+    // 读满后仍没有完整的请求时由工作线程扩大读缓冲区
+    while (m_read_idx < capacity) {
+        bytes_read = recv(m_sockfd, m_read_buf.data() + m_read_idx, capacity - m_read_idx, 0);
         if (bytes_read == -1) {
             if (errno == EAGAIN || errno == EWOULDBLOCK) {
                 break;
@@ -492,14 +991,26 @@ bool http_conn::read() {
 bool http_conn::write() {
     int temp = 0;
     if (bytes_to_send == 0) {
-        modfd(m_epollfd, m_sockfd, EPOLLIN);
-        init();
+        reset_response();
+        if (!has_buffered_request()) {
+            modfd(m_epollfd, m_sockfd, EPOLLIN);
+        }
         return true;
     }
 
     while(1) {
-        // writev() 聚集写，按顺序发送分散内存中的数据
-        temp = writev(m_sockfd, m_iv, m_iv_count);
+        struct iovec* iov = &m_iv[m_iv_idx];
+        if (m_file_fd == -1) {
+            // writev() 聚集写，按顺序发送分散内存中的数据
+            temp = writev(m_sockfd, iov, m_iv_count - m_iv_idx);
+        } else if (iov->iov_base) {
+            // MSG_MORE使响应头暂不发出，与随后sendfile发送的文件内容合并成满长度的报文
+            temp = send(m_sockfd, iov->iov_base, iov->iov_len, (m_iv_idx + 1 < m_iv_count) ? MSG_MORE : 0);
+        } else {
+            // 文件内容由内核直接从页缓存发送，发送缓冲区满后从m_iv_offset记录的偏移继续
+            off_t offset = m_iv_offset[m_iv_idx];
+            temp = sendfile(m_sockfd, m_file_fd, &offset, iov->iov_len);
+        }
         LOG_INFO("send (%d) data to the client(%d)", temp, m_sockfd);
         Log::get_instance()->flush();
         if (temp <= -1) {
@@ -512,31 +1023,72 @@ bool http_conn::write() {
             unmap();
             return false;
         }
-
-        bytes_to_send -= temp;
-        bytes_have_send += temp;
-        // 如果报头消息已经传输完
-        if (bytes_have_send >= m_iv[0].iov_len) {
-            m_iv[0].iov_len = 0;
-            m_iv[1].iov_base = m_file_address + (bytes_have_send - m_write_idx);
-            m_iv[1].iov_len = bytes_to_send;
-        } else {
-            m_iv[0].iov_base = m_write_buf + bytes_have_send;
-            m_iv[0].iov_len = m_iv[0].iov_len - bytes_have_send;
+        if (temp == 0 && m_file_fd != -1) {
+            // 文件在发送过程中被截断，已经无法发出响应头中声明的长度
+            unmap();
+            return false;
         }
 
-        if (bytes_to_send <= 0) {
+        if (!advance(temp)) {
             // 发送HTTP响应成功，根据HTTP请求中的Connection字段决定是否立即关闭连接
-            unmap();
-            modfd(m_epollfd, m_sockfd, EPOLLIN);
-            if (m_linger) {
-                init();
-                return true;
-            } else {
+            // Reactor模式下write()运行在工作线程，必须先重置连接再重新监听，否则新请求可能被另一个工作线程同时处理
+            if (!finish_write()) {
                 return false;
             }
+            // 读缓冲区中已有后续请求时由调用者交给工作线程处理，此时不监听socket，避免两个线程同时处理该连接
+            if (!has_buffered_request()) {
+                modfd(m_epollfd, m_sockfd, EPOLLIN);
+            }
+            return true;
+        }
+    }
+}
+
+bool http_conn::advance(int len) {
+    bytes_to_send -= len;
+    bytes_have_send += len;
+    // 跳过已经发送完的数据块，调整发送了一部分的数据块
+    while (m_iv_idx < m_iv_count && (size_t)len >= m_iv[m_iv_idx].iov_len) {
+        len -= m_iv[m_iv_idx].iov_len;
+        m_iv[m_iv_idx++].iov_len = 0;
+    }
+    if (m_iv_idx < m_iv_count && len > 0) {
+        if (m_iv[m_iv_idx].iov_base) {
+            m_iv[m_iv_idx].iov_base = (char*)m_iv[m_iv_idx].iov_base + len;
+        } else {
+            m_iv_offset[m_iv_idx] += len;
         }
+        m_iv[m_iv_idx].iov_len -= len;
+    }
+    return bytes_to_send > 0;
+}
+
+bool http_conn::finish_write() {
+    unmap();
+    if (m_write_linger) {
+        reset_response();
+        return true;
     }
+    return false;
+}
+
+int http_conn::get_iov(struct iovec* iov) {
+    int count = 0;
+    for (int i = m_iv_idx; i < m_iv_count; i++) {
+        if (m_iv[i].iov_len > 0) {
+            iov[count++] = m_iv[i];
+        }
+    }
+    return count;
+}
+
+int http_conn::feed(const char* data, int len) {
+    if (m_read_idx + len > m_read_buf.capacity()) {
+        len = m_read_buf.capacity() - m_read_idx;
+    }
+    memcpy(m_read_buf.data() + m_read_idx, data, len);
+    m_read_idx += len;
+    return len;
 }
 
 // HTTP响应报文格式
@@ -547,128 +1099,394 @@ bool http_conn::write() {
 
 // 往写缓冲区中写入待发送数据
 //( , ...) 可变参数
+// 先格式化到临时缓冲区，再由add_data()复制到写缓冲区，写缓冲区放不下时随之扩大
 bool http_conn::add_response(const char* format, ...) {
-    if (m_write_idx >= WRITE_BUFFER_SIZE) {
-        return false;
-    }
+    char text[256];
     // 定义一个 va_list 类型变量
     va_list arg_list;
     va_start(arg_list, format);
-    int len = vsnprintf(m_write_buf + m_write_idx, WRITE_BUFFER_SIZE - 1 - m_write_idx, format, arg_list);
-    if (len >= (WRITE_BUFFER_SIZE - 1 - m_write_idx)) {
+    int len = vsnprintf(text, sizeof(text), format, arg_list);
+    // va_start 与 va_end 总是成对出现
+    va_end(arg_list);
+    if (len < 0 || len >= (int)sizeof(text)) {
         return false;
     }
-    m_write_idx += len;
-    // va_start 与 va_end 总是成对出现
-    LOG_INFO("response:\n%s", m_write_buf);
+    LOG_INFO("response:\n%s", text);
     Log::get_instance()->flush();
-    va_end(arg_list);
+    return add_data(text, len);
+}
+
+// 直接复制len字节到写缓冲区，不经过格式化
+bool http_conn::add_data(const char* data, int len) {
+    if (!reserve_write(len)) {
+        return false;
+    }
+    memcpy(m_write_buf.data() + m_write_idx, data, len);
+    m_write_idx += len;
     return true;
 }
 
+bool http_conn::add_canned_response(const canned_response& response) {
+    return add_data(response.header, response.header_len) && add_linger() && add_blank_line() &&
+           add_data(response.body, response.body_len);
+}
+
 bool http_conn::add_status_line(int status, const char* title) {
-    return add_response("%s %d %s\r\n", "HTTP/1.1", status, title);
+    char code[] = {(char)('0' + status / 100), (char)('0' + status / 10 % 10), (char)('0' + status % 10), ' '};
+    return add_data("HTTP/1.1 ", 9) && add_data(code, sizeof(code)) && add_content(title) && add_data("\r\n", 2);
 }
 
 bool http_conn::add_headers(int content_len) {
     add_content_length(content_len);
+    add_content_type();
     add_linger();
     add_blank_line();
     return true;
 }
 
+// 目标文件的响应头，命中缓存时直接复制预先生成的状态行、Content-Length、Content-Type和验证首部
+bool http_conn::add_file_headers() {
+    if (m_compressed) {
+        return add_data(m_compressed->header, m_compressed->header_len) && add_linger() && add_blank_line();
+    }
+    if (!m_file_entry) {
+        add_status_line(200, ok_200_title);
+        add_content_length(m_file_stat.st_size);
+        add_content_type();
+        add_file_meta();
+        add_linger();
+        return add_blank_line();
+    }
+    return add_data(m_file_entry->header, m_file_entry->header_len) && add_linger() && add_blank_line();
+}
+
+// ETag、Last-Modified和Cache-Control首部
+bool http_conn::add_file_meta() {
+    if (m_compressed) {
+        return add_data(m_compressed->meta.headers, m_compressed->meta.headers_len);
+    }
+    if (m_file_entry) {
+        return add_data(m_file_entry->meta.headers, m_file_entry->meta.headers_len);
+    }
+    file_meta meta;
+    make_file_meta(&meta, m_real_file, m_file_stat);
+    return add_data(meta.headers, meta.headers_len);
+}
+
+bool http_conn::add_content_range(off_t start, off_t end) {
+    return add_response("Content-Range: bytes %lld-%lld/%lld\r\n", (long long)start, (long long)end,
+                        (long long)m_file_stat.st_size);
+}
+
+void http_conn::push_buf_iov(int start) {
+    m_iv[m_iv_count].iov_base = m_write_buf.data() + start;
+    m_iv[m_iv_count].iov_len = m_write_idx - start;
+    m_iv_count++;
+    bytes_to_send += m_write_idx - start;
+}
+
+void http_conn::set_file_iov(int index, off_t offset, off_t len) {
+    if (m_file_address) {
+        m_iv[index].iov_base = m_file_address + offset;
+    } else {
+        m_iv[index].iov_base = NULL;
+        m_iv_offset[index] = offset;
+    }
+    m_iv[index].iov_len = len;
+}
+
+// 206响应，单个范围直接发送该范围；多个范围按multipart/byteranges格式，每个范围前有自己的分段头
+// 写缓冲区放不下时返回false，由调用者改为发送整个文件
+bool http_conn::add_partial_response() {
+    static const char status_line[] = "HTTP/1.1 206 Partial Content\r\n";
+    if (m_range_count == 1) {
+        off_t len = m_range_end[0] - m_range_start[0] + 1;
+        if (!add_data(status_line, sizeof(status_line) - 1) || !add_content_length(len) || !add_content_type() ||
+            !add_content_range(m_range_start[0], m_range_end[0]) || !add_file_meta() || !add_linger() ||
+            !add_blank_line()) {
+            return false;
+        }
+        push_buf_iov(m_response_start);
+        set_file_iov(m_iv_count++, m_range_start[0], len);
+        bytes_to_send += len;
+        return true;
+    }
+
+    // 先在写缓冲区中生成各个分段头，算出消息体的总长度后再生成响应头，响应头的数据块预先留出
+    const mime_type* type = get_mime_type(m_real_file);
+    off_t body_len = 0;
+    int header_iv = m_iv_count++;
+    m_iv[header_iv].iov_base = NULL;
+    m_iv[header_iv].iov_len = 0;
+    for (int i = 0; i <= m_range_count; i++) {
+        int part = m_write_idx;
+        if (i == m_range_count) {
+            if (!add_response("\r\n--%s--\r\n", range_boundary.c_str())) {
+                return false;
+            }
+        } else if (!add_response("\r\n--%s\r\n", range_boundary.c_str()) || !add_data(type->header, type->header_len) ||
+                   !add_content_range(m_range_start[i], m_range_end[i]) || !add_blank_line()) {
+            return false;
+        }
+        m_iv[m_iv_count].iov_base = m_write_buf.data() + part;
+        m_iv[m_iv_count].iov_len = m_write_idx - part;
+        body_len += m_write_idx - part;
+        m_iv_count++;
+        if (i < m_range_count) {
+            off_t len = m_range_end[i] - m_range_start[i] + 1;
+            set_file_iov(m_iv_count++, m_range_start[i], len);
+            body_len += len;
+        }
+    }
+    int header = m_write_idx;
+    if (!add_data(status_line, sizeof(status_line) - 1) || !add_content_length(body_len) ||
+        !add_response("Content-Type: multipart/byteranges; boundary=%s\r\n", range_boundary.c_str()) ||
+        !add_file_meta() || !add_linger() || !add_blank_line()) {
+        return false;
+    }
+    m_iv[header_iv].iov_base = m_write_buf.data() + header;
+    m_iv[header_iv].iov_len = m_write_idx - header;
+    bytes_to_send += m_write_idx - header + body_len;
+    return true;
+}
+
 bool http_conn::add_content_length(int content_len) {
-    return add_response("Content-Length: %d\r\n", content_len);
+    // 从低位到高位转换数字，不经过vsnprintf
+    char buf[32] = "Content-Length: ";
+    int len = sizeof("Content-Length: ") - 1;
+    char digits[12];
+    int count = 0;
+    unsigned int value = content_len;
+    do {
+        digits[count++] = '0' + value % 10;
+        value /= 10;
+    } while (value > 0);
+    while (count > 0) {
+        buf[len++] = digits[--count];
+    }
+    buf[len++] = '\r';
+    buf[len++] = '\n';
+    return add_data(buf, len);
+}
+
+// 按目标文件的扩展名添加Content-Type
+bool http_conn::add_content_type() {
+    const mime_type* type = get_mime_type(m_real_file);
+    return add_data(type->header, type->header_len);
 }
 
 bool http_conn::add_linger() {
-    return add_response("Connection: %s\r\n", (m_linger == true) ? "keep-alive" : "close");
+    if (m_linger) {
+        return add_data("Connection: keep-alive\r\n", sizeof("Connection: keep-alive\r\n") - 1);
+    }
+    return add_data("Connection: close\r\n", sizeof("Connection: close\r\n") - 1);
 }
 
 bool http_conn::add_blank_line() {
-    return add_response("%s", "\r\n");
+    return add_data("\r\n", 2);
 }
 
 bool http_conn::add_content(const char* content) {
-    return add_response("%s", content);
+    return add_data(content, strlen(content));
 }
 
 // 根据服务器处理HTTP请求的结果，决定返回给客户端的内容
+// 响应追加在写缓冲区和待发送数据块中已有的内容之后，流水线中的多个响应可以一起发送
 bool http_conn::process_write(HTTP_CODE ret) {
+    m_write_linger = m_linger;
+    m_response_start = m_write_idx;
+    m_response_iv = m_iv_count;
     switch (ret) {
         case INTERNAL_ERROR: {
-            add_status_line(500, error_500_title);
-            add_headers(strlen(error_500_form));
-            if (!add_content(error_500_form)) {
+            if (!add_canned_response(response_500)) {
                 return false;
             }
             break;
         }
         case BAD_REQUEST: {
-            add_status_line(400, error_400_title);
-            add_headers(strlen(error_400_form));
-            if (!add_content(error_400_form)) {
+            if (!add_canned_response(response_400)) {
                 return false;
             }
             break;
         }
         case NO_RESOURCE: {
-            add_status_line(404, error_404_title);
-            add_headers(strlen(error_404_form));
-            if (!add_content(error_404_form)) {
+            if (!add_canned_response(response_404)) {
                 return false;
             }
             break;
         }
         case FORBIDDEN_REQUEST: {
-            add_status_line(403, error_403_title);
-            add_headers(strlen(error_403_form));
-            if (!add_content(error_403_form)) {
+            if (!add_canned_response(response_403)) {
+                return false;
+            }
+            break;
+        }
+        case SERVICE_UNAVAILABLE: {
+            if (!add_canned_response(response_503)) {
+                return false;
+            }
+            break;
+        }
+        case NOT_MODIFIED: {
+            // 304响应只有验证首部，没有消息体
+            if (!add_data("HTTP/1.1 304 Not Modified\r\n", sizeof("HTTP/1.1 304 Not Modified\r\n") - 1) ||
+                !add_file_meta() || !add_linger() || !add_blank_line()) {
+                return false;
+            }
+            break;
+        }
+        case RANGE_NOT_SATISFIABLE: {
+            static const char status_line[] = "HTTP/1.1 416 Range Not Satisfiable\r\n";
+            if (!add_data(status_line, sizeof(status_line) - 1) ||
+                !add_response("Content-Range: bytes */%lld\r\n", (long long)m_file_stat.st_size) ||
+                !add_content_length(0) || !add_linger() || !add_blank_line()) {
                 return false;
             }
             break;
         }
         case FILE_REQUEST: {
-            add_status_line(200, ok_200_title);
             if (m_file_stat.st_size != 0) {
-                add_headers(m_file_stat.st_size);
-                m_iv[0].iov_base = m_write_buf;
-                m_iv[0].iov_len = m_write_idx;
-                m_iv[1].iov_base = m_file_address;
-                m_iv[1].iov_len = m_file_stat.st_size;
-                m_iv_count = 2;
-                bytes_to_send = m_write_idx + m_file_stat.st_size;
-                return true;
-            } else {
-                const char* ok_string = "<html><body>Hello</body></html>";
-                add_headers(strlen(ok_string));
-                if (!add_content(ok_string)) {
+                if (m_range_count > 0 && add_partial_response()) {
+                    return true;
+                }
+                // 没有Range首部，或者分段头放不下写缓冲区时发送整个文件
+                m_write_idx = m_response_start;
+                m_iv_count = m_response_iv;
+                if (!add_file_headers()) {
                     return false;
                 }
+                push_buf_iov(m_response_start);
+                // sendfile发送时文件内容的iov_base为NULL
+                set_file_iov(m_iv_count++, 0, m_file_stat.st_size);
+                bytes_to_send += m_file_stat.st_size;
+                return true;
             }
+            // 空文件只发送Content-Length为0的响应头，没有消息体
+            if (!add_file_headers()) {
+                return false;
+            }
+            break;
         }
         default: {
             return false;
         }
     }
 
-    m_iv[0].iov_base = m_write_buf;
-    m_iv[0].iov_len = m_write_idx;
-    m_iv_count = 1;
-    bytes_to_send = m_write_idx;
+    push_buf_iov(m_response_start);
     return true;
 }
 
+// 统计一次process()的处理时间，记入开始处理时的类别；连接可能已经交给其他线程，结束时不能再访问它
+// 有请求处理时才需要输出统计，由工作线程每隔CLASS_REPORT_INTERVAL顺便输出一次
+class service_timer {
+    public:
+        service_timer(class_stats& stats, long wait): m_stats(stats), m_wait(wait), m_start(class_clock_ns()) {}
+        ~service_timer() {
+            long now = class_clock_ns();
+            m_stats.record(m_wait, now - m_start);
+            http_conn::report_class_stats(now);
+        }
+
+    private:
+        class_stats& m_stats;
+        long m_wait;
+        long m_start;
+};
+
 // 由线程池的工作线程调用，这是HTTP请求的入口函数
+// 转交给其他类别的请求已经解析完，由该类别的工作线程重新执行do_request()，生成响应后按原来的方式发送
 void http_conn::process() {
-    HTTP_CODE read_ret = process_read();
-    if (read_ret == NO_REQUEST) {
-        modfd(m_epollfd, m_sockfd, EPOLLIN);
+    REQUEST_CLASS run_class = m_request_class;
+    service_timer timer(m_class_stats[run_class], class_clock_ns() - m_queued_at);
+    HTTP_CODE read_ret = NO_REQUEST;
+    if (run_class != CLASS_STATIC) {
+        read_ret = do_request();
+        m_request_class = CLASS_STATIC;
+    } else if (m_io_task == IO_WRITE) {
+        // Reactor模式下工作线程自己完成socket上的读写
+        if (!write()) {
+            request_close();
+            return;
+        }
+        if (!has_buffered_request()) {
+            // write()已经重新监听socket
+            clear_busy();
+            return;
+        }
+    } else if (m_io_task == IO_READ && !read()) {
+        request_close();
         return;
     }
-    bool write_ret = process_write(read_ret);
-    if (!write_ret) {
-        close_conn();
+
+    while (true) {
+        if (read_ret == NO_REQUEST) {
+            read_ret = process_read();
+        }
+        if (read_ret == DEFERRED_REQUEST) {
+            if (schedule(m_request_class)) {
+                return;
+            }
+            read_ret = SERVICE_UNAVAILABLE;
+        }
+        if (read_ret == NO_REQUEST) {
+            if (m_read_idx >= m_read_buf.capacity() && !grow_read_buffer()) {
+                // 读缓冲区扩大到上限仍放不下一个完整的请求
+                request_close();
+                return;
+            }
+            rearm(EPOLLIN);
+            return;
+        }
+        bool write_ret = process_write(read_ret);
+        next_request();
+        read_ret = NO_REQUEST;
+        // HTTP流水线：读缓冲区中还有后续的请求时接着处理，响应追加在当前响应之后一起发送
+        // 其他类别的线程只处理转交给它的请求，后续的请求交还给处理静态资源的线程
+        while (run_class == CLASS_STATIC && write_ret && can_pipeline()) {
+            hold_file();
+            read_ret = process_read();
+            if (read_ret == NO_REQUEST) {
+                break;
+            }
+            if (read_ret == DEFERRED_REQUEST) {
+                // 已经生成的响应留在写缓冲区中，由转交后的线程一起发送
+                if (schedule(m_request_class)) {
+                    return;
+                }
+                read_ret = SERVICE_UNAVAILABLE;
+            }
+            write_ret = process_write(read_ret);
+            next_request();
+            read_ret = NO_REQUEST;
+        }
+        if (m_io_task != IO_NONE) {
+            // 直接发送响应，发送缓冲区满时write()会注册EPOLLOUT，由之后的工作线程继续发送
+            if (!write_ret || !write()) {
+                request_close();
+                return;
+            }
+            // 没有合并发送的请求留在读缓冲区中，发送完后继续处理
+            if (!has_buffered_request()) {
+                clear_busy();
+                return;
+            }
+            if (run_class != CLASS_STATIC) {
+                // 交还时写任务为空，write()直接返回，接着处理读缓冲区中的请求
+                m_io_task = IO_WRITE;
+                mark_queued();
+                if (m_class_pools[CLASS_STATIC] && m_class_pools[CLASS_STATIC]->append(this)) {
+                    return;
+                }
+                run_class = CLASS_STATIC;
+            }
+            continue;
+        }
+        // 响应无法生成时交给事件循环关闭，socket、定时器和io_uring中的请求只能由事件循环线程操作
+        if (!write_ret) {
+            request_close();
+            return;
+        }
+        rearm(EPOLLOUT);
+        return;
     }
-    modfd(m_epollfd, m_sockfd, EPOLLOUT);
 }
\ No newline at end of file
@@ -17,105 +17,245 @@
 #include<stdlib.h>
 #include<sys/mman.h>
 #include<sys/uio.h>
+#include<sys/sendfile.h>
 #include<stdarg.h>
 #include<errno.h>
+#include<atomic>
 
 #include"../lock/locker.h"
 #include"../CGImysql/sql_connection_pool.h"
 #include"../log/log.h"
+#include"buffer.h"
+#include"header_table.h"
+#include"../threadpool/request_class.h"
 
 void addfd(int epollfd, int fd, bool one_shot);
 void removefd(int epollfd, int fd);
 int setnonblocking(int fd);
 
+class event_loop;
+template<typename T> class threadpool;
+struct file_entry;
+struct compress_entry;
+struct canned_response;
+struct file_meta;
+
 class http_conn{
     public:
         // 文件名的最大长度
         static const int FILENAME_MAX_LEN = 200;
-        // 读缓冲区的大小
+        // 读缓冲区的内联大小，请求放不下时按需扩大，最大为MAX_READ_BUFFER_SIZE
         static const int READ_BUFFER_SIZE = 2048;
-        // 写缓冲区的大小
+        static const int MAX_READ_BUFFER_SIZE = buffer_pool::MAX_CHUNK_SIZE;
+        // 写缓冲区的内联大小，流水线中的多个响应头依次写入，放不下时按需扩大，最大为MAX_WRITE_BUFFER_SIZE
         static const int WRITE_BUFFER_SIZE = 1024;
+        static const int MAX_WRITE_BUFFER_SIZE = buffer_pool::MAX_CHUNK_SIZE;
+        // 留给一个响应的响应头的写缓冲区空间，剩余空间不足时不再合并后续的响应
+        static const int RESPONSE_BUFFER_SIZE = 1024;
+        // 一次合并发送的流水线响应的最大数量
+        static const int MAX_PIPELINE = 8;
+        // 一个Range请求最多包含的范围数，超过时忽略Range首部发送整个文件
+        static const int MAX_RANGES = 4;
+        // 响应最多由响应头、每个范围的分段头和文件内容以及结束分隔符组成
+        static const int MAX_IOV = MAX_RANGES * 2 + 2;
+        // 合并发送的所有响应的数据块总数上限，普通的文件响应只需要两个数据块
+        static const int WRITE_IOV_SIZE = MAX_IOV + MAX_PIPELINE * 2;
         // HTTP请求方法，目前仅支持GET
         enum METHOD {GET = 0, POST, HEAD, PUT, DELETE, TRACE, OPTIONSS, CONNECT, PATCH};
         // 解析客户请求时主状态机所处的状态
         enum CHECK_STATE {CHECK_STATE_REQUESTLINE = 0, CHECK_STATE_HEADER, CHECK_STATE_CONTENT};
         // 服务器处理HTTP请求可能的结果
+        // DEFERRED_REQUEST表示请求已转交给其他类别的线程池，SERVICE_UNAVAILABLE表示该类别的队列已满
         enum HTTP_CODE {NO_REQUEST, GET_REQUEST, BAD_REQUEST, NO_RESOURCE, FORBIDDEN_REQUEST, 
-                        FILE_REQUEST, INTERNAL_ERROR, CLOSED_CONNECTION};
+                        FILE_REQUEST, NOT_MODIFIED, RANGE_NOT_SATISFIABLE, INTERNAL_ERROR, CLOSED_CONNECTION,
+                        DEFERRED_REQUEST, SERVICE_UNAVAILABLE};
         // 行的读取状态
         enum LINE_STATUS{LINE_OK = 0, LINE_BAD, LINE_OPEN};
+        // Reactor模式下交给工作线程的I/O任务，IO_NONE表示模拟Proactor模式，工作线程只处理请求
+        enum IO_TASK {IO_NONE = 0, IO_READ, IO_WRITE};
     
     public:
-        http_conn(){}
+        http_conn(): m_file_address(NULL), m_file_fd(-1), m_file_entry(NULL), m_compressed(NULL), m_held_count(0) {}
         ~http_conn(){}
 
-        // 初始化新接受的连接
-        void init(int sockfd, const sockaddr_in& addr);
-        // 关闭连接
-        void close_conn(bool real_close = true);
-        // 处理客户请求
+        // 初始化新接受的连接，epollfd为负责该连接的事件循环的epoll内核事件表
+        // 使用io_uring引擎时没有epoll内核事件表，epollfd为-1，由loop负责重新监听socket上的事件
+        // gen为连接的代数，随发给loop的消息一起发出
+        void init(int sockfd, const sockaddr_in& addr, int epollfd, event_loop* loop, unsigned gen);
+        // 处理客户请求，Reactor模式下还要先完成socket上的读写
         void process();
+        // 设置工作线程下一次处理该连接时要完成的I/O任务
+        void set_io_task(IO_TASK task) {
+            m_io_task = task;
+        }
         // 非阻塞读操作
         bool read();
         // 非阻塞写操作
         bool write();
+        // 下面这组函数供io_uring引擎使用，由它代替read()和write()完成socket上的I/O
+        // 追加事件循环已经读到的客户数据，返回读缓冲区中放得下的字节数
+        int feed(const char* data, int len);
+        // 取出待发送的数据块，返回数据块的数量
+        int get_iov(struct iovec* iov);
+        // 已发送len字节，调整待发送的数据块，返回是否还有数据待发送
+        bool advance(int len);
+        // HTTP响应发送完毕，返回是否保持连接
+        bool finish_write();
+        // 响应已经发送完，读缓冲区中还留有流水线中后续请求的数据，需要交给工作线程处理而不是等待socket可读
+        bool has_buffered_request() const {
+            return bytes_to_send == 0 && m_read_idx > 0;
+        }
         // 获取客户地址
         sockaddr_in* get_address() {
             return &m_address;
         }
         // 获取数据库结果
         void initmysql_result(connection_pool* conn_pool);
+        // 释放目标文件的内存映射或文件描述符，连接关闭时由事件循环调用
+        void unmap();
+        // 扩大过的读写缓冲区换回内联缓冲区，连接关闭时由事件循环调用
+        void release_buffers();
+        // 为网站根目录下以path开头的文件设置Cache-Control首部，只能在启动时调用
+        static void add_cache_control(const char* path, const char* value);
+        // 登记请求路由，只能在启动时调用，注册等需要数据库的处理器使用conn_pool
+        static void init_routes(connection_pool* conn_pool);
+        // 设置处理cls类请求的线程池，没有设置的类别在当前工作线程中直接处理，只能在启动时调用
+        // CLASS_STATIC的线程池就是事件循环使用的线程池，其他类别处理完后把流水线中剩余的请求交还给它
+        static void set_class_pool(REQUEST_CLASS cls, threadpool<http_conn>* pool);
+        // 距上次输出超过统计周期时，输出各类请求的队列长度、请求数、排队和处理耗时，并开始新一轮统计
+        // now为class_clock_ns()的返回值，多个线程同时调用时只有一个输出
+        static void report_class_stats(long now);
+        // 交给线程池之前调用，记录进入队列的时间
+        void mark_queued() {
+            m_queued_at = class_clock_ns();
+        }
+        // 下面这组函数供epoll引擎使用，工作线程直接调用modfd交还连接，事件循环需要知道连接是否仍被工作线程持有
+        // 事件循环交给线程池之前调用
+        void mark_busy() {
+            m_busy.fetch_add(1, std::memory_order_relaxed);
+        }
+        // 工作线程交还连接或请求关闭后调用，之后不能再访问该连接
+        void clear_busy() {
+            m_busy.fetch_sub(1, std::memory_order_release);
+        }
+        // 连接是否仍被工作线程持有，持有期间关闭连接会使fd被新连接复用，迟到的响应发给新的客户
+        bool is_busy() const {
+            return m_busy.load(std::memory_order_acquire) > 0;
+        }
 
     private:
         // 初始连接
         void init();
+        // 重置请求的解析状态
+        void reset_request();
+        // 重置待发送的响应
+        void reset_response();
+        // 丢弃已经处理完的请求，把读缓冲区中剩余的数据移到开头，开始解析下一个请求
+        void next_request();
+        // 当前响应之后能否继续处理流水线中的下一个请求，与当前响应合并发送
+        bool can_pipeline() const;
+        // 当前响应的文件交给m_held保管，直到合并发送的所有响应发送完
+        void hold_file();
+        // 读缓冲区已满仍没有完整的请求时扩大读缓冲区，超过上限时返回false
+        bool grow_read_buffer();
+        // 写缓冲区再写入len字节前确保空间足够，扩大时调整指向写缓冲区的数据块
+        bool reserve_write(int len);
+        // 当前请求还没有转交过，cls类有自己的线程池时需要转交
+        bool should_defer(REQUEST_CLASS cls) const;
+        // 把当前连接交给cls类的线程池，队列已满时返回false；返回true后不能再访问该连接
+        bool schedule(REQUEST_CLASS cls);
+        // 重新监听socket上的事件
+        void rearm(int ev);
+        // Reactor模式下由工作线程请求事件循环关闭连接，定时器只能由事件循环操作
+        void request_close();
         // 解析HTTP请求
         HTTP_CODE process_read();
         // 填充HTTP应答
         bool process_write(HTTP_CODE ret);
 
         // 下面这组函数被process_read调用以分析HTTP请求
-        HTTP_CODE parse_request_line(char* text);
-        HTTP_CODE parse_headers(char* text);
+        // len为行的长度，不包括行尾的回车换行符
+        HTTP_CODE parse_request_line(char* text, int len);
+        HTTP_CODE parse_headers(char* text, int len);
         HTTP_CODE parse_content(char* text);
         HTTP_CODE do_request();
-        char* get_line(){return m_read_buf + m_start_line;}
+        // 根据条件请求首部和Range首部决定如何响应文件请求
+        HTTP_CODE check_conditions(const file_meta& meta);
+        // 对没有预压缩变体的文本资源即时压缩，返回false表示不压缩，按原来的方式发送文件
+        bool compress_file(HTTP_CODE* ret);
+        // 根据If-None-Match和If-Modified-Since判断客户缓存的文件是否仍然有效
+        bool check_not_modified(const file_meta& meta);
+        // 解析Range首部，返回可满足的范围数；返回-1表示忽略Range首部，发送整个文件
+        int parse_range(const file_meta& meta);
+        char* get_line(){return m_read_buf.data() + m_start_line;}
+        // 按编号取请求首部的值，请求中没有该首部时返回NULL
+        char* get_header(HEADER_ID id) {
+            const header_field* field = m_headers.find(id);
+            return field ? m_read_buf.data() + field->value : NULL;
+        }
         LINE_STATUS parse_line();
 
         // 下面这组函数被process_write调用以填充HTTP应答
-        void unmap();
         bool add_response(const char* format, ...);
+        bool add_data(const char* data, int len);
+        bool add_canned_response(const canned_response& response);
         bool add_content(const char* content);
         bool add_status_line(int status, const char* title);
         bool add_headers(int content_length);
+        bool add_file_headers();
+        bool add_file_meta();
+        bool add_content_range(off_t start, off_t end);
+        bool add_partial_response();
+        // 将文件中从offset开始的len字节设为第index个待发送的数据块
+        void set_file_iov(int index, off_t offset, off_t len);
+        // 把写缓冲区中从start开始的内容作为下一个待发送的数据块
+        void push_buf_iov(int start);
         bool add_content_type();
         bool add_content_length(int content_length);
         bool add_linger();
         bool add_blank_line();
 
     public:
-        // 所有socket上的事件都被注册到同一个epoll内核事件表中，所以将epoll文件描述符设置为静态的
-        static int m_epollfd;
-        // 统计用户数量
-        static int m_user_count;
-        // 数据库连接
-        MYSQL* mysql;
+        // 统计用户数量，多个事件循环线程会同时修改
+        static std::atomic<int> m_user_count;
+        // 不小于该大小的文件用sendfile发送，更小的文件用mmap加writev，负数表示不使用sendfile
+        static long m_sendfile_threshold;
 
     private:
+        // 该连接所属事件循环的epoll内核事件表
+        int m_epollfd;
+        // 该连接所属的事件循环
+        event_loop* m_loop;
+        // 连接建立时的代数
+        unsigned m_conn_gen;
+        // 工作线程要完成的I/O任务
+        IO_TASK m_io_task;
+        // 当前请求转交给的类别，CLASS_STATIC表示没有转交；每个请求最多转交一次，转交后的类别处理完整个请求
+        REQUEST_CLASS m_request_class;
+        // 进入线程池队列的时间，单位纳秒
+        long m_queued_at;
+        // epoll引擎下交给线程池但还没有交还的次数，交还前新事件可能已经使连接再次进入队列
+        std::atomic<int> m_busy;
+        // 各类别的线程池和统计
+        static threadpool<http_conn>* m_class_pools[CLASS_COUNT];
+        static class_stats m_class_stats[CLASS_COUNT];
         // 该HTTP连接的socket和对方的socket地址
         int m_sockfd;
         sockaddr_in m_address;
-        // 读缓冲区
-        char m_read_buf[READ_BUFFER_SIZE];
+        // 读缓冲区，末尾多留的一个字节给消息体之后的'\0'
+        buffer<READ_BUFFER_SIZE> m_read_buf;
         // 标识只读缓冲中已经读入的客户数据的最后一个字节的下一个位置
         int m_read_idx;
         // 标识正在分析的字符在读缓冲区的位置
         int m_checked_idx;
         // 当前正在解析的行的起始位置
         int m_start_line;
+        // 已经解析完的请求在读缓冲区中的结束位置，之后是流水线中的下一个请求
+        int m_request_end;
+        // 消息体之后被'\0'覆盖的字节，移动剩余数据时恢复
+        char m_request_end_char;
         // 写缓冲区
-        char m_write_buf[WRITE_BUFFER_SIZE];
+        buffer<WRITE_BUFFER_SIZE> m_write_buf;
         // 写缓冲区待发送的字节数
         int m_write_idx;
         // 主状态机当前所处的状态
@@ -128,20 +268,50 @@ class http_conn{
         char* m_url;
         // HTTP协议版本号，目前仅支持HTTP/1.1
         char* m_version;
-        // 主机名
-        char* m_host;
+        // 请求首部表，记录所有首部在读缓冲区中的位置
+        header_table m_headers;
+        // 客户端接受的压缩编码集合
+        int m_accept_encoding;
+        // 要发送的字节范围，包含两端，m_range_count为0表示发送整个文件
+        off_t m_range_start[MAX_RANGES];
+        off_t m_range_end[MAX_RANGES];
+        int m_range_count;
         // HTTP请求的消息体的长度
         int m_content_length;
         // HTTP请求是否要求保持连接
         bool m_linger;
+        // 待发送的最后一个响应是否保持连接，下一个请求的解析不会影响它
+        bool m_write_linger;
         // 客户请求的目标文件被mmap到内存中的起始位置
         char* m_file_address;
+        // 用sendfile发送的目标文件的文件描述符，-1表示目标文件已被mmap或没有目标文件
+        int m_file_fd;
+        // 命中静态资源缓存时的缓存条目，m_file_address和m_file_fd可能属于它，不能由连接释放
+        file_entry* m_file_entry;
+        // 即时压缩时的压缩结果，m_file_address指向其中的内容，此时m_file_stat.st_size为压缩后的大小
+        compress_entry* m_compressed;
         // 目标文件的状态，判断文件是否存在、是否为目录、是否可读，并获取文件大小等信息
         struct stat m_file_stat;
+        // 合并发送的响应中前面几个响应的文件，它们的内容还在待发送的数据块中
+        struct held_file {
+            char* address;
+            off_t size;
+            file_entry* entry;
+            compress_entry* compressed;
+        };
+        held_file m_held[MAX_PIPELINE];
+        int m_held_count;
+        // 当前响应在写缓冲区中的起始位置和第一个数据块
+        int m_response_start;
+        int m_response_iv;
         // 采用writev来执行写操作，所以定义如下两个成员
         // m_iv_count表示被写内存块的数量
-        struct iovec m_iv[2];
+        struct iovec m_iv[WRITE_IOV_SIZE];
         int m_iv_count;
+        // 下一个待发送的数据块
+        int m_iv_idx;
+        // sendfile发送时iov_base为NULL的数据块表示文件内容，这里记录它下一次发送的文件偏移
+        off_t m_iv_offset[WRITE_IOV_SIZE];
         // 是否启用POST
         int cgi;
         // 储存请求头中的数据
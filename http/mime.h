@@ -0,0 +1,207 @@
+// 根据文件扩展名确定响应的Content-Type和Content-Encoding
+// 表中直接存放完整的首部行及其长度，生成响应头时只需一次memcpy
+#ifndef MIME_H
+#define MIME_H
+
+#include<string.h>
+#include<strings.h>
+#include<stdlib.h>
+
+struct mime_type {
+    // 扩展名，不含'.'
+    const char* ext;
+    // 完整的Content-Type首部行
+    const char* header;
+    int header_len;
+    // 文本类的资源，会查找预压缩的变体
+    bool compressible;
+};
+
+#define MIME_TYPE(ext, type, compressible) \
+    {ext, "Content-Type: " type "\r\n", sizeof("Content-Type: " type "\r\n") - 1, compressible}
+
+// 常用的类型排在前面
+static const mime_type mime_types[] = {
+    MIME_TYPE("html", "text/html; charset=utf-8", true),
+    MIME_TYPE("jpg", "image/jpeg", false),
+    MIME_TYPE("mp4", "video/mp4", false),
+    MIME_TYPE("css", "text/css; charset=utf-8", true),
+    MIME_TYPE("js", "text/javascript; charset=utf-8", true),
+    MIME_TYPE("png", "image/png", false),
+    MIME_TYPE("jpeg", "image/jpeg", false),
+    MIME_TYPE("gif", "image/gif", false),
+    MIME_TYPE("ico", "image/x-icon", false),
+    MIME_TYPE("svg", "image/svg+xml", true),
+    MIME_TYPE("webp", "image/webp", false),
+    MIME_TYPE("htm", "text/html; charset=utf-8", true),
+    MIME_TYPE("txt", "text/plain; charset=utf-8", true),
+    MIME_TYPE("json", "application/json", true),
+    MIME_TYPE("xml", "application/xml", true),
+    MIME_TYPE("pdf", "application/pdf", false),
+    MIME_TYPE("webm", "video/webm", false),
+    MIME_TYPE("mp3", "audio/mpeg", false),
+    MIME_TYPE("wav", "audio/wav", false),
+    MIME_TYPE("woff", "font/woff", false),
+    MIME_TYPE("woff2", "font/woff2", false),
+    MIME_TYPE("zip", "application/zip", false),
+};
+
+// 未知扩展名按二进制数据处理
+static const mime_type default_mime_type = MIME_TYPE("", "application/octet-stream", false);
+
+#undef MIME_TYPE
+
+// 预压缩的变体与原文件放在同一目录，文件名为原文件名加上后缀，例如index.html.br、index.html.gz
+struct content_encoding {
+    // Accept-Encoding中的编码名
+    const char* name;
+    // 变体文件的后缀，含'.'
+    const char* suffix;
+    int suffix_len;
+    int flag;
+    // 完整的Content-Encoding首部行
+    const char* header;
+    int header_len;
+};
+
+enum { ENCODING_BR = 1, ENCODING_GZIP = 2, ENCODING_DEFLATE = 4 };
+
+#define CONTENT_ENCODING(name, suffix, flag) \
+    {name, suffix, sizeof(suffix) - 1, flag, "Content-Encoding: " name "\r\n", sizeof("Content-Encoding: " name "\r\n") - 1}
+
+// 客户端同时接受时排在前面的优先，br的压缩率更高
+static const content_encoding content_encodings[] = {
+    CONTENT_ENCODING("br", ".br", ENCODING_BR),
+    CONTENT_ENCODING("gzip", ".gz", ENCODING_GZIP),
+    CONTENT_ENCODING("deflate", ".zz", ENCODING_DEFLATE),
+};
+
+#undef CONTENT_ENCODING
+
+static const int CONTENT_ENCODING_COUNT = sizeof(content_encodings) / sizeof(content_encodings[0]);
+
+// 可压缩的资源都要带上Vary，使中间缓存按Accept-Encoding区分不同的变体
+static const char vary_header[] = "Vary: Accept-Encoding\r\n";
+
+// 返回path中位于end之前、最后一个'/'之后的最后一个扩展名，不含'.'，没有时返回NULL
+inline const char* find_ext(const char* path, const char* end) {
+    for (const char* p = end; p > path; ) {
+        --p;
+        if (*p == '/') {
+            return NULL;
+        }
+        if (*p == '.') {
+            return p + 1;
+        }
+    }
+    return NULL;
+}
+
+// 在类型表中查找长度为len的扩展名，忽略大小写
+inline const mime_type* find_mime_type(const char* ext, size_t len) {
+    for (size_t i = 0; i < sizeof(mime_types) / sizeof(mime_types[0]); i++) {
+        if (strncasecmp(ext, mime_types[i].ext, len) == 0 && mime_types[i].ext[len] == '\0') {
+            return &mime_types[i];
+        }
+    }
+    return NULL;
+}
+
+// path是可压缩资源的预压缩变体时返回变体的编码，type返回原文件的类型；否则返回NULL
+inline const content_encoding* split_encoding(const char* path, const mime_type** type) {
+    const char* end = path + strlen(path);
+    const char* ext = find_ext(path, end);
+    if (ext == NULL) {
+        return NULL;
+    }
+    for (int i = 0; i < CONTENT_ENCODING_COUNT; i++) {
+        if (strcmp(ext - 1, content_encodings[i].suffix) == 0) {
+            const char* base = find_ext(path, ext - 1);
+            const mime_type* base_type = base ? find_mime_type(base, ext - 1 - base) : NULL;
+            if (base_type == NULL || !base_type->compressible) {
+                return NULL;
+            }
+            *type = base_type;
+            return &content_encodings[i];
+        }
+    }
+    return NULL;
+}
+
+// 返回文件路径对应的类型，只看最后一个'/'之后的扩展名，忽略大小写；预压缩的变体返回原文件的类型
+inline const mime_type* get_mime_type(const char* path) {
+    const mime_type* type;
+    if (split_encoding(path, &type)) {
+        return type;
+    }
+    const char* end = path + strlen(path);
+    const char* ext = find_ext(path, end);
+    type = ext ? find_mime_type(ext, end - ext) : NULL;
+    return type ? type : &default_mime_type;
+}
+
+// 返回预压缩变体的编码，不是变体时返回NULL
+inline const content_encoding* get_content_encoding(const char* path) {
+    const mime_type* type;
+    return split_encoding(path, &type);
+}
+
+// 解析Accept-Encoding，返回客户端接受的编码集合；q=0表示拒绝，"*"表示接受其余所有编码
+inline int parse_accept_encoding(const char* list) {
+    int accepted = 0;
+    int refused = 0;
+    bool any = false;
+    while (*list) {
+        list += strspn(list, " \t,");
+        if (*list == '\0') {
+            break;
+        }
+        int len = strcspn(list, ",");
+        int name_len = strcspn(list, " \t;,");
+        bool refuse = false;
+        for (const char* q = list + name_len; q < list + len; q++) {
+            if ((*q == 'q' || *q == 'Q') && q[1] == '=') {
+                refuse = (strtod(q + 2, NULL) == 0);
+                break;
+            }
+        }
+        int flag = 0;
+        if (name_len == 1 && list[0] == '*') {
+            any = !refuse;
+        }
+        for (int i = 0; i < CONTENT_ENCODING_COUNT; i++) {
+            if (strncasecmp(list, content_encodings[i].name, name_len) == 0 && content_encodings[i].name[name_len] == '\0') {
+                flag = content_encodings[i].flag;
+            }
+        }
+        if (refuse) {
+            refused |= flag;
+        } else {
+            accepted |= flag;
+        }
+        list += len;
+    }
+    if (any) {
+        for (int i = 0; i < CONTENT_ENCODING_COUNT; i++) {
+            accepted |= content_encodings[i].flag;
+        }
+    }
+    return accepted & ~refused;
+}
+
+// 在path后加上encodings中优先级最高的编码的后缀，size为path缓冲区的大小，放不下时返回false
+inline bool append_encoding_suffix(char* path, size_t size, int encodings) {
+    size_t len = strlen(path);
+    for (int i = 0; i < CONTENT_ENCODING_COUNT; i++) {
+        if (encodings & content_encodings[i].flag) {
+            if (len + content_encodings[i].suffix_len >= size) {
+                return false;
+            }
+            memcpy(path + len, content_encodings[i].suffix, content_encodings[i].suffix_len + 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+#endif
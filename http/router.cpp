@@ -0,0 +1,102 @@
+#include<string.h>
+#include<algorithm>
+
+#include"router.h"
+
+router::router(): m_root(new_node("")), m_default(NULL) {
+    set_default(new static_file_handler);
+}
+
+router::~router() {
+    free_node(m_root);
+    for (size_t i = 0; i < m_handlers.size(); i++) {
+        delete m_handlers[i];
+    }
+}
+
+router::node* router::new_node(const std::string& label) {
+    node* n = new node;
+    n->label = label;
+    n->handler = NULL;
+    n->methods = 0;
+    return n;
+}
+
+void router::free_node(node* n) {
+    for (size_t i = 0; i < n->children.size(); i++) {
+        free_node(n->children[i]);
+    }
+    delete n;
+}
+
+void router::own(route_handler* handler) {
+    if (std::find(m_handlers.begin(), m_handlers.end(), handler) == m_handlers.end()) {
+        m_handlers.push_back(handler);
+    }
+}
+
+void router::set_default(route_handler* handler) {
+    own(handler);
+    m_default = handler;
+}
+
+// 沿着与path有公共前缀的边向下走，边只匹配了一部分时在公共前缀处拆分出中间节点
+void router::add(const char* path, int methods, route_handler* handler) {
+    own(handler);
+    node* n = m_root;
+    while (*path) {
+        node* child = NULL;
+        for (size_t i = 0; i < n->children.size(); i++) {
+            if (n->children[i]->label[0] == *path) {
+                child = n->children[i];
+                break;
+            }
+        }
+        // 没有首字符相同的边，剩余的路径作为一条新边
+        if (!child) {
+            child = new_node(path);
+            n->children.push_back(child);
+            n = child;
+            break;
+        }
+        size_t common = 0;
+        while (common < child->label.size() && path[common] == child->label[common]) {
+            common++;
+        }
+        if (common < child->label.size()) {
+            node* middle = new_node(child->label.substr(0, common));
+            child->label.erase(0, common);
+            middle->children.push_back(child);
+            std::replace(n->children.begin(), n->children.end(), child, middle);
+            child = middle;
+        }
+        path += common;
+        n = child;
+    }
+    n->handler = handler;
+    n->methods = methods;
+}
+
+route_handler* router::find(const char* url, int method) const {
+    const node* n = m_root;
+    const char* p = url;
+    while (*p != '\0' && *p != '?') {
+        const node* next = NULL;
+        for (size_t i = 0; i < n->children.size(); i++) {
+            if (n->children[i]->label[0] == *p) {
+                next = n->children[i];
+                break;
+            }
+        }
+        // 边上的字符串中没有'\0'和'?'，路径在边的中间结束时比较到它们就会不同
+        if (!next || strncmp(p, next->label.data(), next->label.size()) != 0) {
+            return m_default;
+        }
+        p += next->label.size();
+        n = next;
+    }
+    if (n->handler && (n->methods & method_mask(method))) {
+        return n->handler;
+    }
+    return m_default;
+}
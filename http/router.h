@@ -0,0 +1,95 @@
+// 请求路由，启动时把路径和处理器登记到基数树中，处理请求时按URL路径找到处理器
+// 查找只沿着基数树向下比较一遍路径，不分配内存，耗时与路径长度成正比
+// 新增一个端点只需要实现一个处理器并在启动时登记，不必修改请求处理的代码
+#ifndef ROUTER_H
+#define ROUTER_H
+
+#include<string>
+#include<vector>
+
+#include"../threadpool/request_class.h"
+
+// 处理器需要的请求信息
+struct route_request {
+    // 请求方法，取值为http_conn::METHOD
+    int method;
+    const char* url;
+    // 消息体，没有消息体时body_len为0
+    const char* body;
+    int body_len;
+};
+
+// 处理器基类，handle()返回要发送的文件相对网站根目录的路径
+// 处理器在多个工作线程中同时被调用，自身的状态只能在启动时设置；需要数据库的处理器自己从数据库连接池获取连接
+class route_handler {
+    public:
+        virtual ~route_handler() {}
+        virtual const char* handle(const route_request& request) = 0;
+        // 请求的调度类别，访问数据库等会阻塞的处理器返回对应的类别，在该类别的线程池中调用handle()
+        virtual REQUEST_CLASS request_class() const {
+            return CLASS_STATIC;
+        }
+};
+
+// 静态文件，直接发送URL对应的文件
+class static_file_handler : public route_handler {
+    public:
+        const char* handle(const route_request& request) {
+            return request.url;
+        }
+};
+
+// 固定页面，例如/0对应/register.html
+class page_handler : public route_handler {
+    public:
+        explicit page_handler(const char* page): m_page(page) {}
+        const char* handle(const route_request&) {
+            return m_page.c_str();
+        }
+
+    private:
+        std::string m_page;
+};
+
+class router {
+    public:
+        // 按请求方法登记时使用的掩码，ANY_METHOD表示不限方法
+        static const int ANY_METHOD = -1;
+        static int method_mask(int method) {
+            return 1 << method;
+        }
+
+        router();
+        ~router();
+
+        // 登记路径和处理器，methods为允许的请求方法的掩码；同一路径重复登记时以后登记的为准
+        // 处理器由router负责释放，同一个处理器可以登记到多个路径，只能在启动时调用
+        void add(const char* path, int methods, route_handler* handler);
+        // 没有登记的路径交给默认处理器，默认为静态文件处理器
+        void set_default(route_handler* handler);
+        // 按路径精确匹配，'?'之后的查询字符串不参与匹配；没有匹配或方法不允许时返回默认处理器
+        route_handler* find(const char* url, int method) const;
+
+    private:
+        // 基数树的节点，label为从父节点到该节点的边上的字符串，子节点的label首字符互不相同
+        struct node {
+            std::string label;
+            std::vector<node*> children;
+            route_handler* handler;
+            int methods;
+        };
+
+        router(const router&);
+        router& operator=(const router&);
+
+        static node* new_node(const std::string& label);
+        static void free_node(node* n);
+        // 登记过的处理器，释放时每个只释放一次
+        void own(route_handler* handler);
+
+        node* m_root;
+        route_handler* m_default;
+        std::vector<route_handler*> m_handlers;
+};
+
+#endif
@@ -0,0 +1,93 @@
+// 解析HTTP请求时使用的字符查找函数，查找行尾、请求行中的空白分隔符和首部名之后的冒号
+// x86-64上一次比较16个字节（SSE2总是可用），运行时检测到AVX2时一次比较32个字节，其他平台逐字节比较
+// 只读取[p, end)之内的字节，不会越过已经读入的客户数据
+#ifndef SCAN_H
+#define SCAN_H
+
+#if defined(__x86_64__) || defined(__i386__)
+#include<immintrin.h>
+#define SCAN_X86
+#endif
+
+// 逐字节查找[p, end)中第一个等于a或b的字符，没有时返回end
+static inline const char* scan_any_scalar(const char* p, const char* end, char a, char b) {
+    for (; p < end; p++) {
+        if (*p == a || *p == b) {
+            return p;
+        }
+    }
+    return end;
+}
+
+#ifdef SCAN_X86
+// 每次比较16个字节，比较结果的掩码中最低的置位就是第一个匹配的字符，不足16字节的尾部逐字节比较
+static inline const char* scan_any_sse2(const char* p, const char* end, char a, char b) {
+    const __m128i va = _mm_set1_epi8(a);
+    const __m128i vb = _mm_set1_epi8(b);
+    for (; end - p >= 16; p += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)p);
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb)));
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+    }
+    return scan_any_scalar(p, end, a, b);
+}
+
+__attribute__((target("avx2")))
+static const char* scan_any_avx2(const char* p, const char* end, char a, char b) {
+    const __m256i va = _mm256_set1_epi8(a);
+    const __m256i vb = _mm256_set1_epi8(b);
+    for (; end - p >= 32; p += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)p);
+        unsigned mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, va), _mm256_cmpeq_epi8(v, vb)));
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+    }
+    return scan_any_sse2(p, end, a, b);
+}
+#endif
+
+typedef const char* (*scan_any_func)(const char* p, const char* end, char a, char b);
+
+// 按CPU支持的指令集选择实现
+static inline scan_any_func select_scan_any() {
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return scan_any_avx2;
+    }
+    return scan_any_sse2;
+#else
+    return scan_any_scalar;
+#endif
+}
+
+// 启动时选定的实现
+static const scan_any_func scan_any = select_scan_any();
+
+// 第一个回车符或换行符
+static inline char* scan_line_end(char* p, char* end) {
+    return (char*)scan_any(p, end, '\r', '\n');
+}
+
+// 第一个空格或'\t'
+static inline char* scan_space(char* p, char* end) {
+    return (char*)scan_any(p, end, ' ', '\t');
+}
+
+// 首部名之后的冒号
+static inline char* scan_colon(char* p, char* end) {
+    return (char*)scan_any(p, end, ':', ':');
+}
+
+// 跳过空格和'\t'，分隔符通常只有一个字节，不值得向量化
+static inline char* skip_space(char* p, char* end) {
+    while (p < end && (*p == ' ' || *p == '\t')) {
+        p++;
+    }
+    return p;
+}
+
+#endif
@@ -3,8 +3,15 @@
 #define LOCKER_H
 
 #include <exception>
+#include <atomic>
+#include <climits>
 #include <pthread.h>
 #include <semaphore.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
 // 封装信号量的类
 class sem {
@@ -122,4 +129,50 @@ class cond {
         pthread_cond_t m_cond;
 };
 
+// 基于futex的事件计数，用于让空闲线程休眠，通知方不需要获取任何锁，没有线程休眠时也不进入内核
+// 等待方先用prepare()读取计数，再检查等待的条件，条件仍不满足时带着读到的计数调用wait()
+// 两步之间如果有通知，计数已经改变，wait()立即返回，不会错过通知；wait()可能虚假返回，调用者需要重新检查条件
+class event_count {
+    public:
+        event_count(): m_seq(0), m_waiters(0) {}
+        int prepare() {
+            return m_seq.load();
+        }
+        void wait(int seq) {
+            // 先登记再休眠，通知方看不到登记时一定已经改变了计数，futex会发现计数不同而立即返回
+            m_waiters.fetch_add(1);
+            syscall(SYS_futex, (int*)&m_seq, FUTEX_WAIT_PRIVATE, seq, NULL, NULL, 0);
+            m_waiters.fetch_sub(1);
+        }
+        // 最多等待timeout_ms毫秒，超时返回false
+        bool wait(int seq, int timeout_ms) {
+            struct timespec timeout;
+            timeout.tv_sec = timeout_ms / 1000;
+            timeout.tv_nsec = (timeout_ms % 1000) * 1000000L;
+            m_waiters.fetch_add(1);
+            long ret = syscall(SYS_futex, (int*)&m_seq, FUTEX_WAIT_PRIVATE, seq, &timeout, NULL, 0);
+            bool timed_out = ret == -1 && errno == ETIMEDOUT;
+            m_waiters.fetch_sub(1);
+            return !timed_out;
+        }
+        // 唤醒一个等待的线程
+        void notify_one() {
+            m_seq.fetch_add(1);
+            if (m_waiters.load() > 0) {
+                syscall(SYS_futex, (int*)&m_seq, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+            }
+        }
+        // 唤醒所有等待的线程
+        void notify_all() {
+            m_seq.fetch_add(1);
+            if (m_waiters.load() > 0) {
+                syscall(SYS_futex, (int*)&m_seq, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+            }
+        }
+
+    private:
+        std::atomic<int> m_seq;
+        std::atomic<int> m_waiters;
+};
+
 #endif
\ No newline at end of file
@@ -141,7 +141,13 @@ void Log::write_log(int level, const char* format, ...) {
                      my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday,
                      my_tm.tm_hour, my_tm.tm_min, my_tm.tm_sec, now.tv_sec, s);
 
-    int m = vsnprintf(m_buf + n, m_log_buf_size - 1, format, valst);
+    // 超长的内容被截断，末尾留出换行符和'\0'的位置
+    int m = vsnprintf(m_buf + n, m_log_buf_size - n - 1, format, valst);
+    if (m < 0) {
+        m = 0;
+    } else if (m > m_log_buf_size - n - 2) {
+        m = m_log_buf_size - n - 2;
+    }
     m_buf[n + m] = '\n';
     m_buf[n + m + 1] = '\0';
     log_str = m_buf;
@@ -9,46 +9,24 @@
 #include<stdlib.h>
 #include<cassert>
 #include<sys/epoll.h>
+#include<sys/signalfd.h>
+#include<linux/filter.h>
 
 #include"./lock/locker.h"
 #include"./threadpool/threadpool.h"
 #include"./http/http_conn.h"
 #include"./timer/lst_timer.h"
 #include"./log/log.h"
-
-// 最大文件描述符
-#define MAX_FD 65536
-// 最大事件数
-#define MAX_EVENT_NUMBER 10000
-// 最小超时单位
-#define TIMESLOT 5
+#include"./reactor/epoll_loop.h"
+#include"./reactor/uring_loop.h"
+#include"./cache/file_cache.h"
+#include"./cache/compress_cache.h"
 
 // 这三个函数在http_conn.cpp中定义，改变文件描述符属性
 // void addfd(int epollfd, int fd, bool one_shot);
 // void removefd(int epollfd, int fd);
 // int setnonblocking(int fd);
 
-// 设置管道，当信号触发时，信号处理函数通过管道通知主循环并传递信号值
-static int pipefd[2];
-// 计时器升序链表
-static sort_timer_lst timer_lst;
-
-static int epollfd = 0;
-
-// 信号处理函数
-void sig_handler(int sig) {
-    // 若一个程序或子程序可以“在任意时刻被中断然后操作系统调度执行另外一段代码
-    // 这段代码又调用了该子程序不会出错”，则称其为可重入（re-entrant）的
-    // 反例如进程正在执行malloc，在其堆中分配另外的存储空间，而此时由于捕捉到信号而执行信号处理程序
-    // 而其中又调用malloc，就可能会对进程造成破坏，因为malloc为存储区维护一个链表，此链表可能被更改
-    // errno可能被信号处理程序中的函数重写，所以应该在调用前保存，调用后恢复
-    int save_errno = errno;
-    int msg = sig;
-    // 将信号值写入管道以通知主循环
-    send(pipefd[1], (char*)&msg, 1, 0);
-    errno = save_errno;
-}
-
 // 设置信号函数
 void addsig(int sig, void(handler)(int), bool restart = true) {
     struct sigaction sa;
@@ -61,60 +39,231 @@ void addsig(int sig, void(handler)(int), bool restart = true) {
     assert(sigaction(sig, &sa, NULL) != -1);
 }
 
-// 定时处理任务，重新定时以不断触发SIGALRM信号
-void timer_handler() {
-    if (timer_lst.tick() == false) {
-        LOG_INFO("%s", "ticking while server idle...");
-        Log::get_instance()->flush();
-        printf("ticking while server idle...\n");
-    } else {
-        LOG_INFO("%s", "clock is ticking...");
-        Log::get_instance()->flush();
-        printf("clock is ticking...\n");
+// 创建监听socket，reuseport为true时开启SO_REUSEPORT
+int open_listenfd(const char* ip, int port, bool reuseport) {
+    int listenfd = socket(PF_INET, SOCK_STREAM, 0);
+    assert(listenfd >= 0);
+
+    // Linux 下 tcp 连接断开的时候调用 close() 函数，有优雅断开和强制断开两种方式
+    // 通过设置 socket 描述符一个linger结构体属性
+    // struct linger 
+    //     int l_onoff;
+    //     int l_linger;
+    // };
+    // l_onoff = 0: close()立刻返回，底层会将未发送完的数据发送完成后再释放资源，即优雅退出。
+    // l_onoff != 0; l_linger = 0;close()立刻返回，但不会发送未发送完成的数据，而是通过一个REST包强制的关闭socket描述符，即强制退出。
+    // 连接socket会继承监听socket的设置，强制退出会截断仍在发送缓冲区中的大文件，所以使用优雅退出
+    struct linger tmp = {0, 0};
+    setsockopt(listenfd, SOL_SOCKET, SO_LINGER, &tmp, sizeof(tmp));
+
+    struct sockaddr_in address;
+    bzero(&address, sizeof(address));
+    address.sin_family = AF_INET;
+    // inet_pton() 将点分十进制 ip 地址转化为整数
+    inet_pton(AF_INET, ip, &address.sin_addr);
+    // htons(): host to net short int 将主机的无符号短整型转换为网络字节顺序
+    address.sin_port = htons(port);
+
+    int flag = 1;
+    setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
+    if (reuseport) {
+        // 多个socket绑定同一端口，各自拥有独立的accept队列，避免所有线程争抢同一个监听socket
+        setsockopt(listenfd, SOL_SOCKET, SO_REUSEPORT, &flag, sizeof(flag));
     }
-    alarm(TIMESLOT);
+    int ret = bind(listenfd, (struct sockaddr*) &address, sizeof(address));
+    assert(ret >= 0);
+
+    // 短连接下accept速率很高，全连接队列太小时突发的连接请求会被丢弃，客户端要等SYN重传后才能连上
+    ret = listen(listenfd, SOMAXCONN);
+    assert(ret >= 0);
+    return listenfd;
 }
 
-// 定时器回调函数，删除非连接活动在socket上的注册事件并将其关闭
-void cb_func(client_data* user_data) {
-    epoll_ctl(epollfd, EPOLL_CTL_DEL, user_data->sockfd, 0);
-    assert(user_data);
-    close(user_data->sockfd);
-    http_conn::m_user_count--;
-    LOG_INFO("close file descriper %d", user_data->sockfd);
-    Log::get_instance()->flush();
-    printf("close file descriper %d\n", user_data->sockfd);
+// 为SO_REUSEPORT组挂载经典BPF程序，按处理该连接软中断的CPU选择监听socket
+// 组内socket按创建顺序编号，第i个socket由绑定在CPU i上的线程accept，使连接的收包处理和accept留在同一个核上
+bool attach_reuseport_cbpf(int listenfd, int group_size) {
+    struct sock_filter code[] = {
+        // A = 当前CPU编号
+        {BPF_LD | BPF_W | BPF_ABS, 0, 0, (__u32)(SKF_AD_OFF + SKF_AD_CPU)},
+        // A = A % group_size
+        {BPF_ALU | BPF_MOD | BPF_K, 0, 0, (__u32)group_size},
+        // 返回A作为组内socket的下标
+        {BPF_RET | BPF_A, 0, 0, 0},
+    };
+    struct sock_fprog prog;
+    prog.len = sizeof(code) / sizeof(code[0]);
+    prog.filter = code;
+    return setsockopt(listenfd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) == 0;
 }
 
-void show_error(int connfd, const char* info) {
-    printf("%s", info);
-    send(connfd, info, strlen(info), 0);
-    close(connfd);
+// 根据选择的I/O引擎和并发模型创建事件循环，tick为定时器精度，lazy_timer表示是否懒惰刷新定时器
+event_loop* create_loop(bool use_uring, bool reactor, int tick, bool lazy_timer, http_conn* users,
+                        client_data* users_timer, threadpool<http_conn>* pool) {
+    event_loop* loop = NULL;
+    if (use_uring) {
+        loop = new uring_loop(users, users_timer, pool);
+    } else {
+        loop = new epoll_loop(users, users_timer, pool, reactor);
+    }
+    loop->set_tick(tick);
+    loop->set_lazy_timer(lazy_timer);
+    return loop;
 }
 
 int main(int argc, char* argv[]) {
+    // 在创建任何线程之前屏蔽SIGTERM，之后创建的线程都继承这个信号掩码
+    // 信号不会再打断任何线程中的系统调用，只能由主Reactor通过signalfd读取
+    sigset_t sigmask;
+    sigemptyset(&sigmask);
+    sigaddset(&sigmask, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &sigmask, NULL);
+
     // 异步日志模型
     Log::get_instance()->init("ServerLog", 2000, 800000, 8);
 
-    if (argc < 2) {
-        printf("usage:%s port_number\n", basename(argv[0]));
+    // 从Reactor的数量，0表示单Reactor模式，由主线程完成所有socket上的I/O
+    int sub_reactor_number = 0;
+    // SO_REUSEPORT监听socket的数量，0表示不使用，大于0时每个监听socket由一个绑定CPU的事件循环线程accept
+    int reuseport_number = 0;
+    // 是否挂载按SO_INCOMING_CPU分配连接的BPF程序
+    bool reuseport_cbpf = false;
+    // 是否使用io_uring代替epoll
+    bool use_uring = false;
+    // 并发模型，0为模拟Proactor，1为Reactor
+    int actor_model = 0;
+    // 定时器精度，单位毫秒
+    int tick = DEFAULT_TICK;
+    // 是否懒惰刷新定时器
+    bool lazy_timer = false;
+    // 静态资源缓存的最大文件数，0表示不使用缓存
+    int cache_entries = 256;
+    // 不小于该大小的文本资源即时压缩，负数表示不压缩
+    long compress_min_size = 512;
+    // 压缩结果缓存的最大字节数
+    long compress_cache_size = 16 * 1024 * 1024;
+    // 线程池的调度方式，0为工作窃取，1为共用一个无锁环形队列
+    int scheduler = 0;
+    // 处理静态资源的线程池最多扩展到的线程数，不大于8时线程数固定为8
+    int max_threads = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "r:p:bum:t:lf:c:C:z:Z:q:e:")) != -1) {
+        switch (opt) {
+            case 'r': {
+                sub_reactor_number = atoi(optarg);
+                break;
+            }
+            case 'p': {
+                reuseport_number = atoi(optarg);
+                break;
+            }
+            case 'b': {
+                reuseport_cbpf = true;
+                break;
+            }
+            case 'u': {
+                use_uring = true;
+                break;
+            }
+            case 'm': {
+                actor_model = atoi(optarg);
+                break;
+            }
+            case 't': {
+                tick = atoi(optarg);
+                break;
+            }
+            case 'l': {
+                lazy_timer = true;
+                break;
+            }
+            case 'f': {
+                http_conn::m_sendfile_threshold = atol(optarg);
+                break;
+            }
+            case 'c': {
+                cache_entries = atoi(optarg);
+                break;
+            }
+            case 'C': {
+                // 格式为path:value，例如 -C /test1.jpg:max-age=86400
+                char* value = strchr(optarg, ':');
+                if (value) {
+                    *value++ = '\0';
+                    http_conn::add_cache_control(optarg, value);
+                }
+                break;
+            }
+            case 'z': {
+                compress_min_size = atol(optarg);
+                break;
+            }
+            case 'Z': {
+                compress_cache_size = atol(optarg);
+                break;
+            }
+            case 'q': {
+                scheduler = atoi(optarg);
+                break;
+            }
+            case 'e': {
+                max_threads = atoi(optarg);
+                break;
+            }
+            default: {
+                break;
+            }
+        }
+    }
+
+    // io_uring本身就是异步I/O，由内核完成读写，不支持Reactor模式
+    // SO_REUSEPORT模式下每个监听socket的事件循环自己处理连接，不再分发给从Reactor，不能与-r同时使用
+    if (optind >= argc || sub_reactor_number < 0 || reuseport_number < 0 || actor_model < 0 || actor_model > 1 ||
+        (sub_reactor_number > 0 && reuseport_number > 0) || (reuseport_cbpf && reuseport_number == 0) ||
+        (use_uring && actor_model == 1) || tick <= 0 || cache_entries < 0 ||
+        compress_cache_size < 0 || scheduler < 0 || scheduler > 1 || max_threads < 0) {
+        printf("usage:%s port_number [-r sub_reactor_number | -p reuseport_number [-b]] [-u | -m actor_model] "
+               "[-t tick_ms] [-l] [-f sendfile_threshold] [-c cache_entries] [-C path:cache_control] "
+               "[-z compress_min_size] [-Z compress_cache_size] [-q scheduler] [-e max_threads]\n", basename(argv[0]));
         return 1;
     }
+    bool reactor = (actor_model == 1);
 
     const char* ip = "192.168.17.129";
-    int port = atoi(argv[1]);
+    int port = atoi(argv[optind]);
+
+    // 静态资源缓存，需要sendfile时不映射文件
+    file_cache::get_instance()->init(cache_entries, http_conn::m_sendfile_threshold);
+    // 即时压缩在工作线程中完成，结果按文件和编码缓存
+    compress_cache::get_instance()->init(compress_min_size, compress_cache_size);
 
     // 创建数据库池
     connection_pool* conn_pool = connection_pool::get_instance();
     conn_pool->init("localhost", "root", "root", "yourdb", 3306, 8);
 
-    // 创建线程池
+    // 请求路由，只有需要数据库的请求处理时才从数据库池取得连接
+    http_conn::init_routes(conn_pool);
+
+    // 创建线程池，事件循环把请求交给处理静态资源的线程池，解析后需要访问数据库或即时压缩的请求转交给各自的线程池
+    // 各类别有独立的工作线程和队列上限，数据库变慢时只有注册请求排队，静态资源仍由自己的工作线程及时处理
+    // 数据库和CPU线程池是弹性的，突发请求排队变长时增加线程，空闲后退回下限，平时不占用多余的线程
+    threadpool<http_conn>::SCHEDULER pool_scheduler = scheduler == 1 ? threadpool<http_conn>::MPMC_RING
+                                                                     : threadpool<http_conn>::WORK_STEALING;
+    int cpu_threads = sysconf(_SC_NPROCESSORS_ONLN);
     threadpool<http_conn>* thread_pool = NULL;
+    threadpool<http_conn>* db_pool = NULL;
+    threadpool<http_conn>* cpu_pool = NULL;
     try {
-        thread_pool = new threadpool<http_conn>(conn_pool);
+        thread_pool = new threadpool<http_conn>(8, 10000, pool_scheduler, max_threads);
+        // 同时执行的数据库请求不超过数据库连接数，排队过多时直接返回503
+        db_pool = new threadpool<http_conn>(2, 256, pool_scheduler, 8);
+        // 压缩线程不超过CPU数，避免过度占用CPU
+        cpu_pool = new threadpool<http_conn>(1, 1024, pool_scheduler, cpu_threads > 0 ? cpu_threads : 1);
     } catch(...) {
         return 1;
     }
+    http_conn::set_class_pool(CLASS_STATIC, thread_pool);
+    http_conn::set_class_pool(CLASS_DB, db_pool);
+    http_conn::set_class_pool(CLASS_CPU, cpu_pool);
 
     // 预先为每个可能的客户分配一个 http_conn 对象
     http_conn* users = new http_conn[MAX_FD];
@@ -124,219 +273,92 @@ int main(int argc, char* argv[]) {
     // 初始化数据库读取map(全局变量)
     users->initmysql_result(conn_pool);
 
-    int listenfd = socket(PF_INET, SOCK_STREAM, 0);
-    assert(listenfd >= 0);
-
-    // Linux 下 tcp 连接断开的时候调用 close() 函数，有优雅断开和强制断开两种方式
-    // 通过设置 socket 描述符一个linger结构体属性
-    // struct linger 
-    //     int l_onoff;
-    //     int l_linger;
-    // };
-    // l_onoff = 0: close()立刻返回，底层会将未发送完的数据发送完成后再释放资源，即优雅退出。
-    // l_onoff != 0; l_linger = 0;close()立刻返回，但不会发送未发送完成的数据，而是通过一个REST包强制的关闭socket描述符，即强制退出。
-    struct linger tmp = {1, 0};
-    setsockopt(listenfd, SOL_SOCKET, SO_LINGER, &tmp, sizeof(tmp));
-
-    int ret = 0;
-    struct sockaddr_in address;
-    bzero(&address, sizeof(address));
-    address.sin_family = AF_INET;
-    // inet_pton() 将点分十进制 ip 地址转化为整数
-    inet_pton(AF_INET, ip, &address.sin_addr);
-    // htons(): host to net short int 将主机的无符号短整型转换为网络字节顺序
-    address.sin_port = htons(port);
-
-    int flag = 1;
-    setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
-    ret = bind(listenfd, (struct sockaddr*) &address, sizeof(address));
-    assert(ret >= 0);
-
-    ret = listen(listenfd, 5);
-    assert(ret >= 0);
-
-    epoll_event events[MAX_EVENT_NUMBER];
-    epollfd = epoll_create(5);
-    assert(epollfd != -1);
-    addfd(epollfd, listenfd, false);
-    // 所有socket上的事件都被注册到同一个epoll内核事件表中，所以将epoll文件描述符设置为静态的
-    http_conn::m_epollfd = epollfd;
-
-    // 使用socketpair创建管道，注册pipefd[0]上的可读事件
-    ret = socketpair(PF_UNIX, SOCK_STREAM, 0, pipefd);
-    assert(ret != -1);
-    setnonblocking(pipefd[1]);
-    addfd(epollfd, pipefd[0], false);
+    // SO_REUSEPORT模式下每个事件循环拥有一个独立的监听socket，由内核在它们之间分配新连接
+    std::vector<int> listenfds;
+    if (reuseport_number > 0) {
+        for (int i = 0; i < reuseport_number; i++) {
+            listenfds.push_back(open_listenfd(ip, port, true));
+        }
+        if (reuseport_cbpf && !attach_reuseport_cbpf(listenfds[0], reuseport_number)) {
+            LOG_ERROR("%s:errno is: %d", "attach reuseport cbpf failure", errno);
+        }
+    } else {
+        listenfds.push_back(open_listenfd(ip, port, false));
+    }
 
-    // 设置信号处理函数
-    addsig(SIGALRM, sig_handler, false);
-    addsig(SIGTERM, sig_handler, false);
+    // 被屏蔽的信号由signalfd读取，保持阻塞以便io_uring引擎读取，epoll_loop注册时会将其设为非阻塞
+    int sigfd = signalfd(-1, &sigmask, SFD_CLOEXEC);
+    assert(sigfd != -1);
     // 忽略 SIGPIPE 信号
     // 默认情况下，往一个读端关闭的管道或socket连接中写数据将引发SIGPIPE信号
     // 程序接收到SIGPIPE信号的默认行为是结束进程，所以不希望因为错误的写操作而导致程序退出
     addsig(SIGPIPE, SIG_IGN);
-    bool stop_server = false;
 
     // 预先为所有可能的用户分配定时器相关信息，以socket的fd为索引
-    client_data* users_timer = new client_data[MAX_FD];
-    bool timeout = false;
-    // 定时
-    alarm(TIMESLOT);
-
-    while (!stop_server) {
-        int number = epoll_wait(epollfd, events, MAX_EVENT_NUMBER, -1);
-        if ((number < 0) && (errno != EINTR)) {
-            LOG_ERROR("%s", "epoll failure");
-            break;
-        }
+    client_data* users_timer = new client_data[MAX_FD]();
 
-        for (int i  = 0; i < number; i++) {
-            int sockfd = events[i].data.fd;
-            // 如果就绪的文件描述符是listenfd，处理新到的客户连接
-            if (sockfd == listenfd) {
-                struct sockaddr_in client_address;
-                socklen_t client_addrlength = sizeof(client_address);
-                // 边缘触发
-                while (1) {
-                    int connfd = accept(listenfd, (struct sockaddr*)&client_address, &client_addrlength);
-                    if (connfd < 0) {
-                        LOG_ERROR("%s:errno is: %d", "accept error", errno);
-                        Log::get_instance()->flush();
-                        break;
-                    }
-                    if (http_conn::m_user_count >= MAX_FD) {
-                        show_error(connfd, "Internal server busy");
-                        LOG_ERROR("%s", "Internal server busy");
-                        Log::get_instance()->flush();
-                        break;
-                    }
-                    users[connfd].init(connfd, client_address);
-                    // 初始化client_data数据
-                    users_timer[connfd].address = client_address;
-                    users_timer[connfd].sockfd = connfd;
-                    // 创建定时器
-                    util_timer* timer = new util_timer;
-                    // 绑定用户数据
-                    timer->user_data = &users_timer[connfd];
-                    // 设置回调函数
-                    timer->cb_func = cb_func;
-                    // 设置超时时间
-                    time_t cur = time(NULL);
-                    timer->expire = cur + 3 * TIMESLOT;
-                    // 绑定定时器
-                    users_timer[connfd].timer = timer;
-                    // 将定时器添加到链表中
-                    timer_lst.add_timer(timer);
-                }
-                continue;
-            } else if (events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
-                // 当管道的读端关闭时，写端文件描述符上的POLLHUP事件将被触发
-                // 当socket连接被对方关闭时，socket上的POLLRDHUP事件将被触发
-                // 服务器端关闭连接，移除对应的定时器
-                util_timer* timer = users_timer[sockfd].timer;
-                timer->cb_func(&users_timer[sockfd]);
-                if (timer) {
-                    timer_lst.del_timer(timer);
-                }
-                // v2.0引入定时器后，关闭连接操作由定时器的回调函数执行
-                // users[sockfd].close_conn();
-            } else if ((sockfd == pipefd[0]) && (events[i].events & EPOLLIN)) {
-                // 如果就绪的文件描述符时pipefd[0]则处理信号
-                int sig;
-                char signals[1024];
-                ret = recv(pipefd[0], signals, sizeof(signals), 0);
-                if (ret == -1) {
-                    continue;
-                } else if (ret == 0) {
-                    continue;
-                } else {
-                    // 每个信号值占一个字节
-                    for (int i = 0; i < ret; i++) {
-                        switch (signals[i]) {
-                            // 定时时间到，timeout设为true
-                            // 通常定时任务的优先级不高，可以留到后面完成
-                            case SIGALRM: {
-                                timeout = true;
-                                break;
-                            }
-                            case SIGTERM: {
-                                stop_server = true;
-                            }
-                        }
-                    }
-                }
-            } else if (events[i].events & EPOLLIN) {
-                // 处理客户连接上接收到的数据
-                util_timer* timer = users_timer[sockfd].timer;
-                // 主线程完成数据的读
-                if (users[sockfd].read()) {
-                    // 记录日志接受数据
-                    LOG_INFO("deal with the client(%s)", inet_ntoa(users[sockfd].get_address()->sin_addr));
-                    Log::get_instance()->flush();
-                    // 将该事件放入任务队列中
-                    // 工作线程从队列中取得任务对象后可直接进行处理
-                    thread_pool->append(users + sockfd);
+    // 主Reactor运行在主线程，负责监听socket和信号
+    event_loop* main_loop = create_loop(use_uring, reactor, tick, lazy_timer, users, users_timer, thread_pool);
+    main_loop->add_listenfd(listenfds[0]);
+    main_loop->add_sigfd(sigfd);
 
-                    // 有数据传输时定时器相关操作
-                    if (timer) {
-                        time_t cur = time(NULL);
-                        // 将定时器往后延迟3个单位
-                        timer->expire = cur + 3 * TIMESLOT;
-                        // 更新定时器后调整链表
-                        timer_lst.adjust_timer(timer);
-                        LOG_INFO("%s", "adjust timer once");
-                        Log::get_instance()->flush();
-                    }
-                } else {
-                    timer->cb_func(&users_timer[sockfd]);
-                    if (timer) {
-                        timer_lst.del_timer(timer);
-                    }
-                    // v2.0引入定时器后，关闭连接操作由定时器的回调函数执行
-                    // users[sockfd].close_conn();
-                }
-            } else if (events[i].events & EPOLLOUT) {
-                // 检测到可写事件
-                util_timer* timer = users_timer[sockfd].timer;
-                // 主线程完成数据的写
-                if (users[sockfd].write()) {
-                    // 有数据传输时定时器相关操作
-                    if (timer) {
-                        time_t cur = time(NULL);
-                        timer->expire = cur + 3 * TIMESLOT;
-                        LOG_INFO("%s", "adjust timer once");
-                        Log::get_instance()->flush();
-                        timer_lst.adjust_timer(timer);
-                    }
-                } else {
-                    timer->cb_func(&users_timer[sockfd]);
-                    if (timer) {
-                        timer_lst.del_timer(timer);
-                    }
-                }
-            } else {
-                printf("program shoul never come here...\n");
+    std::vector<event_loop*> sub_loops;
+    if (reuseport_number > 0) {
+        // 每个事件循环accept自己的监听socket，第i个事件循环绑定到第i个CPU上
+        int cpu_number = sysconf(_SC_NPROCESSORS_ONLN);
+        main_loop->set_cpu(0);
+        for (int i = 1; i < reuseport_number; i++) {
+            event_loop* sub_loop = create_loop(use_uring, reactor, tick, lazy_timer, users, users_timer, thread_pool);
+            sub_loop->add_listenfd(listenfds[i]);
+            sub_loop->set_cpu(i % cpu_number);
+            if (!sub_loop->start()) {
+                LOG_ERROR("%s", "create reuseport reactor failure");
+                return 1;
             }
-            if (timeout) {
-                // 处理定时任务
-                timer_handler();
-                timeout = false;
+            sub_loops.push_back(sub_loop);
+        }
+        // 主线程只向它们转发信号，不分发连接
+        main_loop->set_sub_loops(sub_loops, false);
+    } else {
+        // 每个从Reactor拥有独立的epoll内核事件表和定时器，运行在各自的线程中
+        for (int i = 0; i < sub_reactor_number; i++) {
+            event_loop* sub_loop = create_loop(use_uring, reactor, tick, lazy_timer, users, users_timer, thread_pool);
+            if (!sub_loop->start()) {
+                LOG_ERROR("%s", "create sub reactor failure");
+                return 1;
             }
+            sub_loops.push_back(sub_loop);
         }
+        main_loop->set_sub_loops(sub_loops);
     }
-    
-    // 关闭epoll文件描述符
-    close(epollfd);
+
+    main_loop->loop();
+
+    // 等待从Reactor退出
+    for (size_t i = 0; i < sub_loops.size(); i++) {
+        sub_loops[i]->join();
+    }
+    // 停止线程池，处理完已经排队的请求再退出；请求处理完时还会访问事件循环，之后才能删除事件循环
+    // 线程池之间会互相转交请求，停止的线程池不再接受转交，转交失败的请求返回503
+    thread_pool->stop(threadpool<http_conn>::DRAIN_QUEUE);
+    db_pool->stop(threadpool<http_conn>::DRAIN_QUEUE);
+    cpu_pool->stop(threadpool<http_conn>::DRAIN_QUEUE);
+    for (size_t i = 0; i < sub_loops.size(); i++) {
+        delete sub_loops[i];
+    }
+    delete main_loop;
     // 关闭监听socket
-    close(listenfd);
-    // 关闭管道
-    close(pipefd[1]);
-    close(pipefd[0]);
+    for (size_t i = 0; i < listenfds.size(); i++) {
+        close(listenfds[i]);
+    }
+    close(sigfd);
+    // 线程池都已停止，之后才能删除用户数据
+    delete thread_pool;
+    delete db_pool;
+    delete cpu_pool;
     // 删除用户数据
     delete[] users;
     // 删除用户定时器
     delete[] users_timer;
-    // 销毁线程池
-    delete thread_pool;
     return 0;
-}
\ No newline at end of file
+}
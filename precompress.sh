@@ -0,0 +1,34 @@
+#!/bin/sh
+# 为静态资源目录中的文本文件生成预压缩变体file.gz和file.br，服务器按Accept-Encoding选择发送
+# 用法：sh precompress.sh [目录]，默认为root；变体不旧于原文件时跳过，压缩后没有变小的变体被删除
+# 需要gzip，安装了brotli时同时生成.br
+
+dir=${1:-root}
+
+# 压缩一个文件：$1为原文件，$2为后缀，其余为压缩命令，从标准输入读入，写到标准输出
+compress() {
+    src=$1
+    dst=$1$2
+    shift 2
+    if [ -f "$dst" ] && [ ! "$dst" -ot "$src" ]; then
+        return
+    fi
+    "$@" < "$src" > "$dst.tmp" || { rm -f "$dst.tmp"; return; }
+    if [ "$(wc -c < "$dst.tmp")" -ge "$(wc -c < "$src")" ]; then
+        rm -f "$dst.tmp" "$dst"
+        return
+    fi
+    # 修改时间与原文件相同，服务器据此判断变体没有过时
+    touch -r "$src" "$dst.tmp"
+    chmod a+r "$dst.tmp"
+    mv "$dst.tmp" "$dst"
+    echo "$dst"
+}
+
+find "$dir" -type f \( -name '*.html' -o -name '*.htm' -o -name '*.css' -o -name '*.js' -o -name '*.svg' \
+    -o -name '*.txt' -o -name '*.json' -o -name '*.xml' \) | while read -r file; do
+    compress "$file" .gz gzip -9 -n -c
+    if command -v brotli > /dev/null 2>&1; then
+        compress "$file" .br brotli -q 11 -c
+    fi
+done
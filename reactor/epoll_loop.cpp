@@ -0,0 +1,192 @@
+#include<sys/socket.h>
+#include<arpa/inet.h>
+#include<stdio.h>
+#include<unistd.h>
+#include<errno.h>
+#include<cassert>
+#include<sys/epoll.h>
+
+#include"epoll_loop.h"
+
+epoll_loop::epoll_loop(http_conn* users, client_data* users_timer, threadpool<http_conn>* pool, bool reactor):
+    event_loop(users, users_timer, pool), m_reactor(reactor) {
+    m_epollfd = epoll_create(5);
+    assert(m_epollfd != -1);
+}
+
+epoll_loop::~epoll_loop() {
+    close(m_epollfd);
+}
+
+void epoll_loop::init_conn(int connfd, const sockaddr_in& addr) {
+    m_users[connfd].init(connfd, addr, m_epollfd, this, m_users_timer[connfd].gen);
+}
+
+void epoll_loop::close_sock(int sockfd) {
+    epoll_ctl(m_epollfd, EPOLL_CTL_DEL, sockfd, 0);
+    // 响应没有发送完就关闭连接时，释放目标文件的映射和sendfile使用的文件描述符
+    m_users[sockfd].unmap();
+    m_users[sockfd].release_buffers();
+    close(sockfd);
+}
+
+void epoll_loop::deal_close(int sockfd) {
+    // 工作线程发出关闭请求后不再使用该连接
+    m_users[sockfd].clear_busy();
+    event_loop::deal_close(sockfd);
+}
+
+bool epoll_loop::conn_busy(int sockfd) {
+    return m_users[sockfd].is_busy();
+}
+
+void epoll_loop::submit_busy(int sockfd) {
+    m_users[sockfd].mark_busy();
+    submit(sockfd);
+}
+
+void epoll_loop::deal_listen() {
+    struct sockaddr_in client_address;
+    socklen_t client_addrlength = sizeof(client_address);
+    // 边缘触发
+    while (1) {
+        int connfd = accept(m_listenfd, (struct sockaddr*)&client_address, &client_addrlength);
+        if (connfd < 0) {
+            LOG_ERROR("%s:errno is: %d", "accept error", errno);
+            Log::get_instance()->flush();
+            break;
+        }
+        new_conn(connfd, client_address);
+    }
+}
+
+void epoll_loop::read_notify() {
+    notify_msg msgs[64];
+    while (true) {
+        // 管道中的消息都是整条写入的，缓冲区大小为消息大小的整数倍，所以每次读到的都是完整的消息
+        int ret = read(m_notifyfd[0], msgs, sizeof(msgs));
+        if (ret <= 0) {
+            break;
+        }
+        deal_notify(msgs, ret / sizeof(notify_msg));
+    }
+}
+
+void epoll_loop::read_signal() {
+    signalfd_siginfo signals[16];
+    int ret = read(m_sigfd, signals, sizeof(signals));
+    if (ret <= 0) {
+        return;
+    }
+    deal_signal(signals, ret / sizeof(signalfd_siginfo));
+}
+
+void epoll_loop::read_timer() {
+    // 读出到期次数，使timerfd不再可读
+    uint64_t expirations;
+    if (read(m_timerfd, &expirations, sizeof(expirations)) > 0) {
+        m_timeout = true;
+    }
+}
+
+void epoll_loop::deal_read(int sockfd) {
+    if (m_reactor) {
+        // 由工作线程完成数据的读，EPOLLONESHOT保证同一时刻只有一个工作线程处理该连接
+        m_users[sockfd].set_io_task(http_conn::IO_READ);
+        submit_busy(sockfd);
+        adjust_timer(sockfd);
+        return;
+    }
+    // 事件循环线程完成数据的读
+    if (m_users[sockfd].read()) {
+        // 记录日志接受数据
+        LOG_INFO("deal with the client(%s)", inet_ntoa(m_users[sockfd].get_address()->sin_addr));
+        Log::get_instance()->flush();
+        // 将该事件放入任务队列中
+        // 工作线程从队列中取得任务对象后可直接进行处理
+        submit_busy(sockfd);
+        // 有数据传输时定时器相关操作
+        adjust_timer(sockfd);
+    } else {
+        // v2.0引入定时器后，关闭连接操作由定时器的回调函数执行
+        close_conn(sockfd);
+    }
+}
+
+void epoll_loop::deal_write(int sockfd) {
+    if (m_reactor) {
+        // 由工作线程继续发送上次没有发完的响应
+        m_users[sockfd].set_io_task(http_conn::IO_WRITE);
+        submit_busy(sockfd);
+        adjust_timer(sockfd);
+        return;
+    }
+    // 事件循环线程完成数据的写
+    if (m_users[sockfd].write()) {
+        if (m_users[sockfd].has_buffered_request()) {
+            // 流水线中还有已经读入的请求，不必等待socket可读
+            submit_busy(sockfd);
+        }
+        // 有数据传输时定时器相关操作
+        adjust_timer(sockfd);
+    } else {
+        close_conn(sockfd);
+    }
+}
+
+void epoll_loop::run() {
+    if (m_listenfd != -1) {
+        addfd(m_epollfd, m_listenfd, false);
+    }
+    if (m_sigfd != -1) {
+        addfd(m_epollfd, m_sigfd, false);
+    }
+    addfd(m_epollfd, m_notifyfd[0], false);
+    addfd(m_epollfd, m_timerfd, false);
+
+    epoll_event events[MAX_EVENT_NUMBER];
+    while (!m_stop) {
+        int number = epoll_wait(m_epollfd, events, MAX_EVENT_NUMBER, -1);
+        if ((number < 0) && (errno != EINTR)) {
+            LOG_ERROR("%s", "epoll failure");
+            break;
+        }
+        update_clock();
+
+        for (int i = 0; i < number; i++) {
+            int sockfd = events[i].data.fd;
+            if (sockfd == m_listenfd) {
+                // 如果就绪的文件描述符是listenfd，处理新到的客户连接
+                deal_listen();
+            } else if (sockfd == m_notifyfd[0]) {
+                // 其他线程通过通知管道传递的新连接和控制消息
+                read_notify();
+            } else if (sockfd == m_timerfd) {
+                // 最早的定时器到期
+                read_timer();
+            } else if ((sockfd == m_sigfd) && (events[i].events & EPOLLIN)) {
+                // 如果就绪的文件描述符是signalfd则处理信号
+                read_signal();
+            } else if (events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                // 当socket连接被对方关闭时，socket上的POLLRDHUP事件将被触发
+                // 服务器端关闭连接，移除对应的定时器
+                // EPOLLONESHOT使工作线程持有连接期间收不到该连接上的事件，这里关闭的连接不会仍在线程池中
+                close_conn(sockfd);
+            } else if (events[i].events & EPOLLIN) {
+                deal_read(sockfd);
+            } else if (events[i].events & EPOLLOUT) {
+                deal_write(sockfd);
+            } else {
+                printf("program shoul never come here...\n");
+            }
+        }
+
+        if (m_timeout) {
+            // 处理定时任务
+            timer_handler();
+            m_timeout = false;
+        }
+        // 本轮事件可能添加、延后或删除了定时器
+        update_timer();
+    }
+}
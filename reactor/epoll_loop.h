@@ -0,0 +1,42 @@
+// 基于epoll(ET)的事件循环
+// 模拟Proactor模式下事件循环线程完成socket上的读写，工作线程只负责处理请求
+// Reactor模式下事件循环线程只负责监听事件，读、处理和写都交给工作线程，大文件的发送不会阻塞其他连接上的事件分发
+#ifndef EPOLL_LOOP_H
+#define EPOLL_LOOP_H
+
+#include"event_loop.h"
+
+class epoll_loop : public event_loop {
+    public:
+        epoll_loop(http_conn* users, client_data* users_timer, threadpool<http_conn>* pool, bool reactor = false);
+        ~epoll_loop();
+
+    protected:
+        void run();
+        void init_conn(int connfd, const sockaddr_in& addr);
+        void close_sock(int sockfd);
+        void deal_close(int sockfd);
+        bool conn_busy(int sockfd);
+
+    private:
+        // 处理监听socket上的新连接
+        void deal_listen();
+        // 读取通知管道上的消息
+        void read_notify();
+        // 读取signalfd上的信号
+        void read_signal();
+        // 读取timerfd
+        void read_timer();
+        void deal_read(int sockfd);
+        void deal_write(int sockfd);
+        // 把连接交给线程池处理，工作线程交还之前连接不会被定时器关闭
+        void submit_busy(int sockfd);
+
+    private:
+        // 该事件循环的epoll内核事件表
+        int m_epollfd;
+        // 是否使用Reactor模式
+        bool m_reactor;
+};
+
+#endif
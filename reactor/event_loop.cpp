@@ -0,0 +1,317 @@
+#include<sched.h>
+#include<sys/socket.h>
+#include<arpa/inet.h>
+#include<stdio.h>
+#include<unistd.h>
+#include<errno.h>
+#include<string.h>
+#include<signal.h>
+#include<sys/timerfd.h>
+#include<cassert>
+
+#include"event_loop.h"
+
+event_loop::event_loop(http_conn* users, client_data* users_timer, threadpool<http_conn>* pool):
+    m_listenfd(-1), m_sigfd(-1), m_timer_armed(-1), m_lazy_timer(false), m_now(get_ms()), m_users(users),
+    m_users_timer(users_timer), m_pool(pool), m_dispatch_conn(false), m_next_sub(0), m_cpu(-1), m_timeout(false),
+    m_stop(false) {
+    // 使用管道而不是socketpair，写入不超过PIPE_BUF字节的消息是原子的，多个线程同时写也不会交错
+    int ret = pipe(m_notifyfd);
+    assert(ret != -1);
+    // 每个事件循环有自己的timerfd，不再依赖SIGALRM，也不需要主Reactor转发定时通知
+    // 与通知管道一样保持阻塞，io_uring对非阻塞fd的读会直接返回-EAGAIN，epoll_loop注册时会将其设为非阻塞
+    m_timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    assert(m_timerfd != -1);
+}
+
+event_loop::~event_loop() {
+    close(m_notifyfd[0]);
+    close(m_notifyfd[1]);
+    close(m_timerfd);
+}
+
+void event_loop::add_listenfd(int listenfd) {
+    m_listenfd = listenfd;
+}
+
+void event_loop::add_sigfd(int sigfd) {
+    m_sigfd = sigfd;
+}
+
+void event_loop::set_sub_loops(const std::vector<event_loop*>& sub_loops, bool dispatch_conn) {
+    m_sub_loops = sub_loops;
+    m_dispatch_conn = dispatch_conn && !sub_loops.empty();
+}
+
+void event_loop::set_cpu(int cpu) {
+    m_cpu = cpu;
+}
+
+void event_loop::set_tick(int tick) {
+    m_timers.set_resolution(tick);
+}
+
+void event_loop::set_lazy_timer(bool lazy) {
+    m_lazy_timer = lazy;
+}
+
+bool event_loop::notify(const notify_msg& msg) {
+    return write(m_notifyfd[1], &msg, sizeof(msg)) == sizeof(msg);
+}
+
+bool event_loop::dispatch(int connfd, const sockaddr_in& addr) {
+    notify_msg msg;
+    memset(&msg, '\0', sizeof(msg));
+    msg.type = NOTIFY_CONN;
+    msg.connfd = connfd;
+    msg.addr = addr;
+    return notify(msg);
+}
+
+void event_loop::notify_stop() {
+    notify_msg msg;
+    memset(&msg, '\0', sizeof(msg));
+    msg.type = NOTIFY_STOP;
+    notify(msg);
+}
+
+void event_loop::rearm(int sockfd, unsigned gen, int ev) {
+    notify_msg msg;
+    memset(&msg, '\0', sizeof(msg));
+    msg.type = NOTIFY_EVENT;
+    msg.connfd = sockfd;
+    msg.gen = gen;
+    msg.ev = ev;
+    notify(msg);
+}
+
+void event_loop::close_later(int sockfd, unsigned gen) {
+    notify_msg msg;
+    memset(&msg, '\0', sizeof(msg));
+    msg.type = NOTIFY_CLOSE;
+    msg.connfd = sockfd;
+    msg.gen = gen;
+    notify(msg);
+}
+
+void* event_loop::worker(void* arg) {
+    event_loop* loop = (event_loop*)arg;
+    loop->loop();
+    return loop;
+}
+
+bool event_loop::start() {
+    return pthread_create(&m_thread, NULL, worker, this) == 0;
+}
+
+void event_loop::join() {
+    pthread_join(m_thread, NULL);
+}
+
+void event_loop::loop() {
+    if (m_cpu >= 0) {
+        cpu_set_t cpuset;
+        CPU_ZERO(&cpuset);
+        CPU_SET(m_cpu, &cpuset);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset) != 0) {
+            LOG_ERROR("bind event loop to cpu %d failure", m_cpu);
+        }
+    }
+    run();
+}
+
+void event_loop::cb_func(client_data* user_data) {
+    assert(user_data);
+    user_data->loop->close_sock(user_data->sockfd);
+    // 定时器随后会被删除，避免之后的关闭请求再次关闭该连接
+    user_data->timer = NULL;
+    // 工作线程之后发来的消息属于已关闭的连接
+    user_data->gen++;
+    http_conn::m_user_count--;
+    LOG_INFO("close file descriper %d", user_data->sockfd);
+    Log::get_instance()->flush();
+    printf("close file descriper %d\n", user_data->sockfd);
+}
+
+void event_loop::timeout_func(client_data* user_data) {
+    assert(user_data);
+    event_loop* loop = user_data->loop;
+    if (loop->conn_busy(user_data->sockfd)) {
+        // 请求还在线程池中排队或处理，可能在等待数据库，此时关闭会使迟到的响应发给复用该fd的新连接
+        user_data->last_active = loop->m_now;
+        user_data->timer->expire = loop->m_now + CONN_TIMEOUT;
+        loop->m_timers.add_timer(user_data->timer);
+        return;
+    }
+    if (loop->m_lazy_timer) {
+        time_t expire = user_data->last_active + CONN_TIMEOUT;
+        if (expire > loop->m_now) {
+            // 连接在超时时间内有过活动，按最后活动时间重新计算超时时间
+            user_data->timer->expire = expire;
+            loop->m_timers.add_timer(user_data->timer);
+            return;
+        }
+    }
+    cb_func(user_data);
+}
+
+void event_loop::submit(int sockfd) {
+    m_users[sockfd].mark_queued();
+    m_pool->append(m_users + sockfd);
+}
+
+// 定时处理任务
+void event_loop::timer_handler() {
+    if (m_timers.tick() == false) {
+        LOG_INFO("%s", "ticking while server idle...");
+        Log::get_instance()->flush();
+        printf("ticking while server idle...\n");
+    } else {
+        LOG_INFO("%s", "clock is ticking...");
+        Log::get_instance()->flush();
+        printf("clock is ticking...\n");
+    }
+    // timerfd是一次性的，触发后需要重新设置
+    m_timer_armed = -1;
+}
+
+void event_loop::update_clock() {
+    m_now = get_ms();
+}
+
+void event_loop::update_timer() {
+    time_t next = m_timers.next_expire();
+    if (next == m_timer_armed) {
+        return;
+    }
+    // 使用绝对时间，最早的定时器已经到期时timerfd立即触发；没有定时器时全零表示取消
+    struct itimerspec its;
+    memset(&its, '\0', sizeof(its));
+    if (next != -1) {
+        its.it_value.tv_sec = next / 1000;
+        its.it_value.tv_nsec = (next % 1000) * 1000000;
+    }
+    timerfd_settime(m_timerfd, TFD_TIMER_ABSTIME, &its, NULL);
+    m_timer_armed = next;
+}
+
+static void show_error(int connfd, const char* info) {
+    printf("%s", info);
+    send(connfd, info, strlen(info), 0);
+    close(connfd);
+}
+
+void event_loop::new_conn(int connfd, const sockaddr_in& addr) {
+    if (http_conn::m_user_count >= MAX_FD) {
+        show_error(connfd, "Internal server busy");
+        LOG_ERROR("%s", "Internal server busy");
+        Log::get_instance()->flush();
+        return;
+    }
+    if (!m_dispatch_conn) {
+        add_conn(connfd, addr);
+    } else {
+        // 轮流分发给从Reactor
+        m_sub_loops[m_next_sub]->dispatch(connfd, addr);
+        m_next_sub = (m_next_sub + 1) % m_sub_loops.size();
+    }
+}
+
+void event_loop::add_conn(int connfd, const sockaddr_in& addr) {
+    // fd可能被刚关闭的连接用过，新的代数使旧连接残留的消息失效
+    m_users_timer[connfd].gen++;
+    init_conn(connfd, addr);
+    // 初始化client_data数据
+    m_users_timer[connfd].address = addr;
+    m_users_timer[connfd].sockfd = connfd;
+    m_users_timer[connfd].loop = this;
+    // 使用内嵌在client_data中的定时器，不必为每个连接申请内存
+    util_timer* timer = &m_users_timer[connfd].timer_node;
+    // 绑定用户数据
+    timer->user_data = &m_users_timer[connfd];
+    // 设置回调函数
+    timer->cb_func = timeout_func;
+    // 设置超时时间
+    m_users_timer[connfd].last_active = m_now;
+    timer->expire = m_now + CONN_TIMEOUT;
+    // 绑定定时器
+    m_users_timer[connfd].timer = timer;
+    // 将定时器添加到时间轮中
+    m_timers.add_timer(timer);
+}
+
+void event_loop::deal_notify(const notify_msg* msgs, int number) {
+    for (int i = 0; i < number; i++) {
+        switch (msgs[i].type) {
+            case NOTIFY_CONN: {
+                add_conn(msgs[i].connfd, msgs[i].addr);
+                break;
+            }
+            case NOTIFY_STOP: {
+                m_stop = true;
+                break;
+            }
+            case NOTIFY_EVENT: {
+                if (msgs[i].gen != m_users_timer[msgs[i].connfd].gen) {
+                    deal_stale(msgs[i].connfd);
+                } else {
+                    deal_event(msgs[i].connfd, msgs[i].ev);
+                }
+                break;
+            }
+            case NOTIFY_CLOSE: {
+                if (msgs[i].gen != m_users_timer[msgs[i].connfd].gen) {
+                    deal_stale(msgs[i].connfd);
+                } else {
+                    deal_close(msgs[i].connfd);
+                }
+                break;
+            }
+        }
+    }
+}
+
+void event_loop::deal_close(int sockfd) {
+    // 连接可能已经因为超时被关闭
+    if (m_users_timer[sockfd].timer) {
+        close_conn(sockfd);
+    }
+}
+
+void event_loop::deal_signal(const signalfd_siginfo* signals, int number) {
+    for (int i = 0; i < number; i++) {
+        switch (signals[i].ssi_signo) {
+            // 信号只会通知到主Reactor，由它转告各个从Reactor
+            case SIGTERM: {
+                m_stop = true;
+                for (size_t j = 0; j < m_sub_loops.size(); j++) {
+                    m_sub_loops[j]->notify_stop();
+                }
+                break;
+            }
+        }
+    }
+}
+
+void event_loop::adjust_timer(int sockfd) {
+    util_timer* timer = m_users_timer[sockfd].timer;
+    if (timer && m_lazy_timer) {
+        // 只记录最后活动时间，定时器到期时再处理
+        m_users_timer[sockfd].last_active = m_now;
+    } else if (timer) {
+        // 将定时器往后延迟
+        timer->expire = m_now + CONN_TIMEOUT;
+        // 更新定时器后调整其在时间轮中的位置
+        m_timers.adjust_timer(timer);
+        LOG_INFO("%s", "adjust timer once");
+        Log::get_instance()->flush();
+    }
+}
+
+void event_loop::close_conn(int sockfd) {
+    util_timer* timer = m_users_timer[sockfd].timer;
+    cb_func(&m_users_timer[sockfd]);
+    if (timer) {
+        m_timers.del_timer(timer);
+    }
+}
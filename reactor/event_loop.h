@@ -0,0 +1,158 @@
+// 事件循环基类，每个事件循环拥有独立的定时器、timerfd、通知管道和线程
+// 单Reactor模式下只有一个事件循环，既负责accept新连接也负责连接上的读写
+// 主从Reactor模式下，主Reactor只负责accept，然后将新连接轮流分发给各个从Reactor
+// 具体的I/O多路复用方式由派生类实现：epoll_loop使用epoll，uring_loop使用io_uring
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include<vector>
+#include<pthread.h>
+#include<netinet/in.h>
+#include<sys/signalfd.h>
+
+#include"../threadpool/threadpool.h"
+#include"../http/http_conn.h"
+#include"../timer/lst_timer.h"
+#include"../timer/time_wheel.h"
+
+// 最大文件描述符
+#define MAX_FD 65536
+// 最大事件数
+#define MAX_EVENT_NUMBER 10000
+// 非活动连接的超时时间，单位毫秒
+#define CONN_TIMEOUT 15000
+// 默认的定时器精度，单位毫秒
+#define DEFAULT_TICK 1000
+
+class event_loop {
+    public:
+        // users和users_timer都以socket的fd为索引，由所有事件循环共享
+        // 每个fd同一时刻只属于一个事件循环，所以各事件循环实际只使用其中属于自己的一部分
+        event_loop(http_conn* users, client_data* users_timer, threadpool<http_conn>* pool);
+        virtual ~event_loop();
+
+        // 由该事件循环负责监听socket上的accept
+        void add_listenfd(int listenfd);
+        // 由该事件循环读取signalfd上的信号
+        void add_sigfd(int sigfd);
+        // 设置从Reactor，信号会转告给它们，dispatch_conn为true时新连接也轮流分发给它们
+        void set_sub_loops(const std::vector<event_loop*>& sub_loops, bool dispatch_conn = true);
+        // 将事件循环线程绑定到指定CPU上，需要在loop()或start()之前调用
+        void set_cpu(int cpu);
+        // 设置定时器精度，单位毫秒，需要在loop()或start()之前调用
+        void set_tick(int tick);
+        // 开启定时器懒惰刷新，需要在loop()或start()之前调用
+        // 有数据传输时只记录连接的最后活动时间，定时器到期时才检查连接是否仍然活跃，活跃则按最后活动时间重新加入时间轮
+        void set_lazy_timer(bool lazy);
+
+        // 由主Reactor调用，把新连接交给当前事件循环，线程安全
+        bool dispatch(int connfd, const sockaddr_in& addr);
+        // 通知事件循环退出，线程安全
+        void notify_stop();
+        // 由工作线程调用，请求事件循环重新监听socket上的ev事件，线程安全
+        // 仅用于没有epoll内核事件表的事件循环，epoll下http_conn直接调用modfd
+        // gen为连接建立时的代数，连接已经关闭或fd已经被新连接复用时消息会被丢弃
+        void rearm(int sockfd, unsigned gen, int ev);
+        // 由工作线程调用，请求事件循环关闭连接，线程安全
+        void close_later(int sockfd, unsigned gen);
+
+        // 在调用线程中运行事件循环
+        void loop();
+        // 创建新线程运行事件循环
+        bool start();
+        // 等待事件循环线程退出
+        void join();
+
+        // 定时器回调函数，删除非连接活动在socket上的注册事件并将其关闭
+        static void cb_func(client_data* user_data);
+        // 定时器到期时调用，懒惰刷新模式下连接在超时时间内有过活动则重新加入时间轮，否则调用cb_func关闭连接
+        // 工作线程仍持有的连接从现在起重新计时
+        static void timeout_func(client_data* user_data);
+
+    protected:
+        // 通知管道中传递的消息类型
+        enum NOTIFY_TYPE {NOTIFY_CONN = 0, NOTIFY_STOP, NOTIFY_EVENT, NOTIFY_CLOSE};
+        struct notify_msg {
+            int type;
+            int connfd;
+            // NOTIFY_EVENT和NOTIFY_CLOSE消息所属连接的代数
+            unsigned gen;
+            // NOTIFY_EVENT消息中请求监听的事件
+            int ev;
+            sockaddr_in addr;
+        };
+
+        // 事件循环主体，由派生类实现
+        virtual void run() = 0;
+        // 初始化新连接的http_conn
+        virtual void init_conn(int connfd, const sockaddr_in& addr) = 0;
+        // 关闭连接的socket
+        virtual void close_sock(int sockfd) = 0;
+        // 处理NOTIFY_EVENT消息
+        virtual void deal_event(int sockfd, int ev) {}
+        // 处理NOTIFY_CLOSE消息，工作线程发出消息后不再使用该连接
+        virtual void deal_close(int sockfd);
+        // 处理代数不符的NOTIFY_EVENT和NOTIFY_CLOSE消息，连接在工作线程处理期间已经被关闭
+        virtual void deal_stale(int sockfd) {}
+        // 工作线程是否仍持有该连接，持有期间定时器到期时不关闭连接
+        virtual bool conn_busy(int sockfd) {
+            return false;
+        }
+
+        bool notify(const notify_msg& msg);
+        // accept到新连接后调用，本地处理或分发给从Reactor
+        void new_conn(int connfd, const sockaddr_in& addr);
+        // 初始化新连接的http_conn和定时器
+        void add_conn(int connfd, const sockaddr_in& addr);
+        // 处理通知管道上的消息
+        void deal_notify(const notify_msg* msgs, int number);
+        // 处理signalfd上读到的信号
+        void deal_signal(const signalfd_siginfo* signals, int number);
+        // 把连接交给线程池处理，记录进入队列的时间
+        void submit(int sockfd);
+        // 有数据传输时将定时器往后延迟
+        void adjust_timer(int sockfd);
+        // 关闭连接并删除对应的定时器
+        void close_conn(int sockfd);
+        // 定时处理任务
+        void timer_handler();
+        // 把timerfd设置为在最早的定时器到期时触发，每轮事件处理完后调用
+        void update_timer();
+        // 更新缓存的当前时间，每轮等待事件返回后调用一次
+        void update_clock();
+
+    private:
+        static void* worker(void* arg);
+
+    protected:
+        // 监听socket，-1表示不负责accept
+        int m_listenfd;
+        // signalfd，-1表示不处理信号
+        int m_sigfd;
+        // 定时器到期时可读的timerfd
+        int m_timerfd;
+        // timerfd当前设置的触发时间，-1表示未设置
+        time_t m_timer_armed;
+        // 通知管道，其他线程通过m_notifyfd[1]向该事件循环传递新连接等消息
+        int m_notifyfd[2];
+        // 分层时间轮，添加、调整和删除定时器都是O(1)
+        time_wheel m_timers;
+        // 是否开启定时器懒惰刷新
+        bool m_lazy_timer;
+        // 本轮事件开始处理时的时间，单位毫秒，同一轮中的事件共用，避免每个事件都读取时钟
+        time_t m_now;
+        http_conn* m_users;
+        client_data* m_users_timer;
+        threadpool<http_conn>* m_pool;
+        // 从Reactor及下一个接收新连接的从Reactor下标
+        std::vector<event_loop*> m_sub_loops;
+        bool m_dispatch_conn;
+        int m_next_sub;
+        // 绑定的CPU，-1表示不绑定
+        int m_cpu;
+        bool m_timeout;
+        bool m_stop;
+        pthread_t m_thread;
+};
+
+#endif
@@ -0,0 +1,218 @@
+// 对io_uring系统调用的简单封装，不依赖liburing
+// 提交队列(SQ)和完成队列(CQ)都是内核与用户态共享的环形缓冲区，通过mmap映射到用户空间
+// 用户态填写SQE并移动SQ尾指针，调用io_uring_enter通知内核；内核完成后写入CQE并移动CQ尾指针
+// 该类不是线程安全的，只能由拥有它的事件循环线程使用
+#ifndef URING_H
+#define URING_H
+
+#include<unistd.h>
+#include<string.h>
+#include<sys/mman.h>
+#include<sys/syscall.h>
+#include<linux/io_uring.h>
+
+class uring {
+    public:
+        uring(): m_ring_fd(-1), m_sq_ptr(MAP_FAILED), m_cq_ptr(MAP_FAILED), m_sqes(NULL),
+            m_buf_ring(NULL), m_bufs(NULL) {}
+
+        ~uring() {
+            if (m_buf_ring) {
+                munmap(m_buf_ring, m_buf_ring_size);
+                delete[] m_bufs;
+            }
+            if (m_sqes) {
+                munmap(m_sqes, m_params.sq_entries * sizeof(struct io_uring_sqe));
+            }
+            if (m_cq_ptr != MAP_FAILED && m_cq_ptr != m_sq_ptr) {
+                munmap(m_cq_ptr, m_cq_size);
+            }
+            if (m_sq_ptr != MAP_FAILED) {
+                munmap(m_sq_ptr, m_sq_size);
+            }
+            if (m_ring_fd != -1) {
+                close(m_ring_fd);
+            }
+        }
+
+        // 创建entries个SQE的io_uring实例并映射共享的环形缓冲区
+        bool init(unsigned entries) {
+            memset(&m_params, 0, sizeof(m_params));
+            // 只有一个线程提交请求，且由该线程在io_uring_enter中执行内核的完成回调，减少跨核中断
+            m_params.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_COOP_TASKRUN | IORING_SETUP_CLAMP;
+            m_ring_fd = syscall(__NR_io_uring_setup, entries, &m_params);
+            if (m_ring_fd < 0) {
+                // 旧内核不支持上面的标志
+                memset(&m_params, 0, sizeof(m_params));
+                m_params.flags = IORING_SETUP_CLAMP;
+                m_ring_fd = syscall(__NR_io_uring_setup, entries, &m_params);
+            }
+            if (m_ring_fd < 0) {
+                return false;
+            }
+
+            m_sq_size = m_params.sq_off.array + m_params.sq_entries * sizeof(unsigned);
+            m_cq_size = m_params.cq_off.cqes + m_params.cq_entries * sizeof(struct io_uring_cqe);
+            // 新内核可以用一次mmap同时映射SQ和CQ
+            if (m_params.features & IORING_FEAT_SINGLE_MMAP) {
+                if (m_cq_size > m_sq_size) {
+                    m_sq_size = m_cq_size;
+                }
+                m_cq_size = m_sq_size;
+            }
+            m_sq_ptr = mmap(0, m_sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                            m_ring_fd, IORING_OFF_SQ_RING);
+            if (m_sq_ptr == MAP_FAILED) {
+                return false;
+            }
+            if (m_params.features & IORING_FEAT_SINGLE_MMAP) {
+                m_cq_ptr = m_sq_ptr;
+            } else {
+                m_cq_ptr = mmap(0, m_cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                m_ring_fd, IORING_OFF_CQ_RING);
+                if (m_cq_ptr == MAP_FAILED) {
+                    return false;
+                }
+            }
+            void* sqes = mmap(0, m_params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                              MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_SQES);
+            if (sqes == MAP_FAILED) {
+                return false;
+            }
+            m_sqes = (struct io_uring_sqe*)sqes;
+
+            char* sq = (char*)m_sq_ptr;
+            m_sq_head = (unsigned*)(sq + m_params.sq_off.head);
+            m_sq_tail = (unsigned*)(sq + m_params.sq_off.tail);
+            m_sq_mask = *(unsigned*)(sq + m_params.sq_off.ring_mask);
+            m_sq_array = (unsigned*)(sq + m_params.sq_off.array);
+            char* cq = (char*)m_cq_ptr;
+            m_cq_head = (unsigned*)(cq + m_params.cq_off.head);
+            m_cq_tail = (unsigned*)(cq + m_params.cq_off.tail);
+            m_cq_mask = *(unsigned*)(cq + m_params.cq_off.ring_mask);
+            m_cqes = (struct io_uring_cqe*)(cq + m_params.cq_off.cqes);
+            m_local_tail = *m_sq_tail;
+            return true;
+        }
+
+        // 获取一个空闲的SQE，SQ已满时先提交已有的请求
+        struct io_uring_sqe* get_sqe() {
+            unsigned head = __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+            if (m_local_tail - head >= m_params.sq_entries) {
+                submit(0);
+                head = __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+                if (m_local_tail - head >= m_params.sq_entries) {
+                    return NULL;
+                }
+            }
+            unsigned index = m_local_tail & m_sq_mask;
+            struct io_uring_sqe* sqe = &m_sqes[index];
+            memset(sqe, 0, sizeof(*sqe));
+            m_sq_array[index] = index;
+            m_local_tail++;
+            return sqe;
+        }
+
+        // 提交所有填写好的SQE，并等待至少wait_nr个CQE，一次系统调用同时完成提交和等待
+        int submit(unsigned wait_nr) {
+            unsigned to_submit = m_local_tail - *m_sq_tail;
+            __atomic_store_n(m_sq_tail, m_local_tail, __ATOMIC_RELEASE);
+            unsigned flags = wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0;
+            if (to_submit == 0 && wait_nr == 0) {
+                return 0;
+            }
+            return syscall(__NR_io_uring_enter, m_ring_fd, to_submit, wait_nr, flags, NULL, 0);
+        }
+
+        // 取出一个CQE，没有则返回NULL，处理完后需调用cqe_seen()
+        struct io_uring_cqe* peek_cqe() {
+            unsigned head = *m_cq_head;
+            if (head == __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE)) {
+                return NULL;
+            }
+            return &m_cqes[head & m_cq_mask];
+        }
+
+        void cqe_seen() {
+            __atomic_store_n(m_cq_head, *m_cq_head + 1, __ATOMIC_RELEASE);
+        }
+
+        // 注册提供给内核的缓冲区环，count个大小为size的缓冲区
+        // 内核在数据到达时才从环中挑选缓冲区，空闲连接不占用读缓冲区
+        bool setup_buf_ring(unsigned short bgid, unsigned count, unsigned size) {
+            m_buf_count = count;
+            m_buf_size = size;
+            m_buf_ring_size = count * sizeof(struct io_uring_buf);
+            void* ring = mmap(0, m_buf_ring_size, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+            if (ring == MAP_FAILED) {
+                return false;
+            }
+            memset(ring, 0, m_buf_ring_size);
+            m_buf_ring = (struct io_uring_buf_ring*)ring;
+            m_bufs = new char[(size_t)count * size];
+
+            struct io_uring_buf_reg reg;
+            memset(&reg, 0, sizeof(reg));
+            reg.ring_addr = (unsigned long)m_buf_ring;
+            reg.ring_entries = count;
+            reg.bgid = bgid;
+            if (syscall(__NR_io_uring_register, m_ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+                return false;
+            }
+            m_buf_ring->tail = 0;
+            for (unsigned i = 0; i < count; i++) {
+                put_buf(i, i);
+            }
+            __atomic_store_n(&m_buf_ring->tail, (unsigned short)count, __ATOMIC_RELEASE);
+            return true;
+        }
+
+        char* get_buf(unsigned short bid) {
+            return m_bufs + (size_t)bid * m_buf_size;
+        }
+
+        // 将用完的缓冲区还给内核
+        void recycle_buf(unsigned short bid) {
+            unsigned short tail = m_buf_ring->tail;
+            put_buf(bid, tail);
+            __atomic_store_n(&m_buf_ring->tail, (unsigned short)(tail + 1), __ATOMIC_RELEASE);
+        }
+
+    private:
+        void put_buf(unsigned short bid, unsigned short pos) {
+            // 内核头文件中的bufs柔性数组在C++下会因为空结构体占一个字节而错位，直接按数组访问
+            struct io_uring_buf* buf = (struct io_uring_buf*)m_buf_ring + (pos & (m_buf_count - 1));
+            buf->addr = (unsigned long)get_buf(bid);
+            buf->len = m_buf_size;
+            buf->bid = bid;
+        }
+
+    private:
+        int m_ring_fd;
+        struct io_uring_params m_params;
+        void* m_sq_ptr;
+        void* m_cq_ptr;
+        size_t m_sq_size;
+        size_t m_cq_size;
+        // 提交队列
+        struct io_uring_sqe* m_sqes;
+        unsigned* m_sq_head;
+        unsigned* m_sq_tail;
+        unsigned* m_sq_array;
+        unsigned m_sq_mask;
+        // 已填写但尚未对内核可见的SQ尾指针
+        unsigned m_local_tail;
+        // 完成队列
+        struct io_uring_cqe* m_cqes;
+        unsigned* m_cq_head;
+        unsigned* m_cq_tail;
+        unsigned m_cq_mask;
+        // 提供给内核的缓冲区环，数量必须是2的幂
+        struct io_uring_buf_ring* m_buf_ring;
+        size_t m_buf_ring_size;
+        char* m_bufs;
+        unsigned m_buf_count;
+        unsigned m_buf_size;
+};
+
+#endif
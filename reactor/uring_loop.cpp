@@ -0,0 +1,422 @@
+#include<sys/socket.h>
+#include<arpa/inet.h>
+#include<stdio.h>
+#include<unistd.h>
+#include<errno.h>
+#include<string.h>
+#include<sys/epoll.h>
+
+#include"uring_loop.h"
+
+// SQ的大小
+static const unsigned URING_ENTRIES = 4096;
+// 缓冲区环的编号、缓冲区数量（必须是2的幂）和每个缓冲区的大小
+static const unsigned short URING_BGID = 0;
+static const unsigned URING_BUF_COUNT = 1024;
+static const unsigned URING_BUF_SIZE = http_conn::READ_BUFFER_SIZE;
+// 每个连接最多暂存的缓冲区数，达到后暂停接收，一个读得慢的连接不会占满整个缓冲区环
+static const size_t URING_CONN_BUFS = 8;
+
+uring_loop::uring_loop(http_conn* users, client_data* users_timer, threadpool<http_conn>* pool):
+    event_loop(users, users_timer, pool), m_conns(MAX_FD), m_recycled(0) {
+    for (int i = 0; i < MAX_FD; i++) {
+        m_conns[i].gen = 0;
+        m_conns[i].open = false;
+        m_conns[i].busy = false;
+        m_conns[i].sending = false;
+        m_conns[i].recv_armed = false;
+        m_conns[i].recv_paused = false;
+        m_conns[i].starved = false;
+    }
+}
+
+uring_loop::~uring_loop() {
+}
+
+void uring_loop::init_conn(int connfd, const sockaddr_in& addr) {
+    // 没有epoll内核事件表，由事件循环负责重新监听socket上的事件
+    m_users[connfd].init(connfd, addr, -1, this, m_users_timer[connfd].gen);
+    conn_state& state = m_conns[connfd];
+    state.gen++;
+    state.open = true;
+    state.busy = false;
+    state.recv_armed = false;
+    state.recv_paused = false;
+    state.starved = false;
+    state.pending.clear();
+    submit_recv(connfd);
+}
+
+void uring_loop::close_sock(int sockfd) {
+    conn_state& state = m_conns[sockfd];
+    state.open = false;
+    // 代数加一，之后到达的该连接的完成事件都将被丢弃
+    state.gen++;
+    for (size_t i = 0; i < state.pending.size(); i++) {
+        recycle(state.pending[i].bid);
+    }
+    state.pending.clear();
+    state.starved = false;
+    // io_uring中尚未完成的请求持有socket的引用，只close不会结束挂起的recv和send，先shutdown使其立即完成
+    shutdown(sockfd, SHUT_RDWR);
+    // 工作线程仍在处理或响应正在发送时，http_conn和文件映射还在使用，等工作线程通知或发送完成后再释放
+    // 在此之前socket不关闭，fd不会被新连接复用
+    if (!state.busy) {
+        finish_close(sockfd);
+    }
+}
+
+void uring_loop::finish_close(int sockfd) {
+    m_conns[sockfd].busy = false;
+    m_users[sockfd].unmap();
+    m_users[sockfd].release_buffers();
+    close(sockfd);
+}
+
+void uring_loop::deal_close(int sockfd) {
+    // 工作线程已经不再使用该连接，可以立即释放
+    m_conns[sockfd].busy = false;
+    close_conn(sockfd);
+}
+
+void uring_loop::deal_stale(int sockfd) {
+    conn_state& state = m_conns[sockfd];
+    if (!state.open && state.busy && !state.sending) {
+        finish_close(sockfd);
+    }
+}
+
+void uring_loop::submit_accept() {
+    struct io_uring_sqe* sqe = m_ring.get_sqe();
+    if (!sqe) {
+        return;
+    }
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = m_listenfd;
+    // 一次提交，每个新连接都产生一个完成事件
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = make_data(OP_ACCEPT, m_listenfd, 0);
+}
+
+void uring_loop::submit_recv(int sockfd) {
+    struct io_uring_sqe* sqe = m_ring.get_sqe();
+    if (!sqe) {
+        return;
+    }
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = sockfd;
+    // 由内核在数据到达时从缓冲区环中挑选缓冲区
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BGID;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->user_data = make_data(OP_RECV, sockfd, m_conns[sockfd].gen);
+    m_conns[sockfd].recv_armed = true;
+    m_conns[sockfd].recv_paused = false;
+}
+
+void uring_loop::resume_recv(int sockfd) {
+    conn_state& state = m_conns[sockfd];
+    if (state.open && !state.recv_armed && !state.starved && state.pending.size() < URING_CONN_BUFS) {
+        submit_recv(sockfd);
+    }
+}
+
+void uring_loop::pause_recv(int sockfd) {
+    conn_state& state = m_conns[sockfd];
+    if (!state.recv_armed || state.recv_paused) {
+        return;
+    }
+    struct io_uring_sqe* sqe = m_ring.get_sqe();
+    if (!sqe) {
+        return;
+    }
+    // 按user_data匹配要取消的recv，取消后recv以-ECANCELED结束
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = make_data(OP_RECV, sockfd, state.gen);
+    sqe->user_data = make_data(OP_CANCEL, sockfd, state.gen);
+    state.recv_paused = true;
+}
+
+void uring_loop::recycle(unsigned short bid) {
+    m_ring.recycle_buf(bid);
+    m_recycled++;
+}
+
+void uring_loop::submit_read(int fd, int op, void* buf, int len) {
+    struct io_uring_sqe* sqe = m_ring.get_sqe();
+    if (!sqe) {
+        return;
+    }
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long)buf;
+    sqe->len = len;
+    // 管道不支持文件偏移
+    sqe->off = (unsigned long long)-1;
+    sqe->user_data = make_data(op, fd, 0);
+}
+
+void uring_loop::submit_send(int sockfd) {
+    conn_state& state = m_conns[sockfd];
+    int count = m_users[sockfd].get_iov(state.iov);
+    if (count == 0) {
+        finish_send(sockfd);
+        return;
+    }
+    struct io_uring_sqe* sqe = m_ring.get_sqe();
+    if (!sqe) {
+        m_users[sockfd].finish_write();
+        state.busy = false;
+        close_conn(sockfd);
+        return;
+    }
+    state.sending = true;
+    // 响应头和文件内容用一个sendmsg发送，与epoll下的writev相同，避免两个小报文之间受Nagle算法影响
+    memset(&state.msg, '\0', sizeof(state.msg));
+    state.msg.msg_iov = state.iov;
+    state.msg.msg_iovlen = count;
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = sockfd;
+    sqe->addr = (unsigned long)&state.msg;
+    sqe->len = 1;
+    // MSG_WAITALL使内核在发送缓冲区不足时自动重试，直到整个响应发送完
+    sqe->msg_flags = MSG_WAITALL | MSG_NOSIGNAL;
+    sqe->user_data = make_data(OP_SEND, sockfd, state.gen);
+}
+
+void uring_loop::deal_accept(struct io_uring_cqe* cqe) {
+    if (cqe->res >= 0) {
+        int connfd = cqe->res;
+        // multishot accept不返回客户地址
+        struct sockaddr_in client_address;
+        socklen_t client_addrlength = sizeof(client_address);
+        getpeername(connfd, (struct sockaddr*)&client_address, &client_addrlength);
+        new_conn(connfd, client_address);
+    } else {
+        LOG_ERROR("%s:errno is: %d", "accept error", -cqe->res);
+        Log::get_instance()->flush();
+    }
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+        submit_accept();
+    }
+}
+
+void uring_loop::deal_recv(int sockfd, struct io_uring_cqe* cqe) {
+    conn_state& state = m_conns[sockfd];
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+        state.recv_armed = false;
+    }
+    if (cqe->res == -ENOBUFS) {
+        // 缓冲区暂时用完了，立即重新提交只会再次失败，等有缓冲区归还后再提交
+        if (!state.starved) {
+            state.starved = true;
+            m_starved.push_back(sockfd);
+        }
+        return;
+    }
+    if (cqe->res == -ECANCELED) {
+        // 暂存的缓冲区达到上限而取消的recv，期间可能已经取走了一些数据
+        resume_recv(sockfd);
+        return;
+    }
+    if (cqe->res <= 0) {
+        // 对方关闭连接或出错
+        close_conn(sockfd);
+        return;
+    }
+
+    unsigned short bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+    pending_buf buf = {bid, 0, cqe->res};
+    state.pending.push_back(buf);
+    if (!state.busy) {
+        flush_pending(sockfd);
+    }
+    if (state.pending.size() >= URING_CONN_BUFS) {
+        // 取消生效前内核可能已经把socket中的数据取到更多缓冲区中，暂存数会略超过上限
+        pause_recv(sockfd);
+    } else {
+        resume_recv(sockfd);
+    }
+}
+
+void uring_loop::flush_pending(int sockfd) {
+    conn_state& state = m_conns[sockfd];
+    if (state.pending.empty()) {
+        return;
+    }
+    // 读缓冲区满时剩余的数据继续暂存，等流水线中前面的请求处理完腾出空间；请求本身放不下时由工作线程扩大读缓冲区
+    size_t fed = 0;
+    for (; fed < state.pending.size(); fed++) {
+        pending_buf& buf = state.pending[fed];
+        int len = m_users[sockfd].feed(m_ring.get_buf(buf.bid) + buf.offset, buf.len);
+        buf.offset += len;
+        buf.len -= len;
+        if (buf.len > 0) {
+            break;
+        }
+        recycle(buf.bid);
+    }
+    state.pending.erase(state.pending.begin(), state.pending.begin() + fed);
+    // 暂存的缓冲区减少了，因达到上限而暂停的接收可以继续
+    resume_recv(sockfd);
+
+    // 记录日志接受数据
+    LOG_INFO("deal with the client(%s)", inet_ntoa(m_users[sockfd].get_address()->sin_addr));
+    Log::get_instance()->flush();
+    state.busy = true;
+    submit(sockfd);
+    // 有数据传输时定时器相关操作
+    adjust_timer(sockfd);
+}
+
+void uring_loop::deal_send(int sockfd, struct io_uring_cqe* cqe) {
+    m_conns[sockfd].sending = false;
+    if (cqe->res < 0) {
+        // 释放文件映射后关闭连接
+        m_users[sockfd].finish_write();
+        m_conns[sockfd].busy = false;
+        close_conn(sockfd);
+    } else if (m_users[sockfd].advance(cqe->res)) {
+        // 发送被信号等打断，继续发送剩余的数据
+        submit_send(sockfd);
+    } else {
+        finish_send(sockfd);
+    }
+}
+
+void uring_loop::finish_send(int sockfd) {
+    // 发送HTTP响应成功，根据HTTP请求中的Connection字段决定是否立即关闭连接
+    if (m_users[sockfd].finish_write()) {
+        conn_state& state = m_conns[sockfd];
+        adjust_timer(sockfd);
+        if (state.pending.empty() && m_users[sockfd].has_buffered_request()) {
+            // 流水线中还有已经读入的请求，连接保持忙碌，直接交给工作线程
+            submit(sockfd);
+            return;
+        }
+        state.busy = false;
+        flush_pending(sockfd);
+    } else {
+        m_conns[sockfd].busy = false;
+        close_conn(sockfd);
+    }
+}
+
+void uring_loop::deal_event(int sockfd, int ev) {
+    if (sockfd < 0) {
+        return;
+    }
+    if (ev == EPOLLOUT) {
+        // 工作线程已经生成了HTTP响应
+        submit_send(sockfd);
+    } else {
+        // 请求还不完整，需要继续读取客户数据
+        m_conns[sockfd].busy = false;
+        flush_pending(sockfd);
+    }
+}
+
+void uring_loop::run() {
+    if (!m_ring.init(URING_ENTRIES) || !m_ring.setup_buf_ring(URING_BGID, URING_BUF_COUNT, URING_BUF_SIZE)) {
+        LOG_ERROR("%s:errno is: %d", "io_uring setup failure", errno);
+        Log::get_instance()->flush();
+        printf("io_uring setup failure\n");
+        return;
+    }
+    if (m_listenfd != -1) {
+        submit_accept();
+    }
+    if (m_sigfd != -1) {
+        submit_read(m_sigfd, OP_SIGNAL, m_signal_buf, sizeof(m_signal_buf));
+    }
+    submit_read(m_notifyfd[0], OP_NOTIFY, m_notify_buf, sizeof(m_notify_buf));
+    submit_read(m_timerfd, OP_TIMER, &m_timer_buf, sizeof(m_timer_buf));
+
+    while (!m_stop) {
+        // 提交本轮产生的所有请求并等待至少一个完成事件
+        int ret = m_ring.submit(1);
+        if ((ret < 0) && (errno != EINTR)) {
+            LOG_ERROR("%s", "io_uring failure");
+            break;
+        }
+        update_clock();
+
+        struct io_uring_cqe* cqe;
+        while ((cqe = m_ring.peek_cqe()) != NULL) {
+            int op = cqe->user_data & 0xff;
+            int fd = (cqe->user_data >> 8) & 0xffffff;
+            unsigned gen = cqe->user_data >> 32;
+            switch (op) {
+                case OP_ACCEPT: {
+                    deal_accept(cqe);
+                    break;
+                }
+                case OP_NOTIFY: {
+                    // 管道中的消息都是整条写入的，缓冲区大小为消息大小的整数倍，所以每次读到的都是完整的消息
+                    if (cqe->res > 0) {
+                        deal_notify(m_notify_buf, cqe->res / sizeof(notify_msg));
+                    }
+                    submit_read(m_notifyfd[0], OP_NOTIFY, m_notify_buf, sizeof(m_notify_buf));
+                    break;
+                }
+                case OP_SIGNAL: {
+                    if (cqe->res > 0) {
+                        deal_signal(m_signal_buf, cqe->res / sizeof(signalfd_siginfo));
+                    }
+                    submit_read(m_sigfd, OP_SIGNAL, m_signal_buf, sizeof(m_signal_buf));
+                    break;
+                }
+                case OP_TIMER: {
+                    if (cqe->res > 0) {
+                        m_timeout = true;
+                    }
+                    submit_read(m_timerfd, OP_TIMER, &m_timer_buf, sizeof(m_timer_buf));
+                    break;
+                }
+                case OP_CANCEL: {
+                    // 取消请求本身的结果不需要处理，被取消的recv另有完成事件
+                    break;
+                }
+                case OP_RECV:
+                case OP_SEND: {
+                    if (gen != m_conns[fd].gen || !m_conns[fd].open) {
+                        // 已关闭连接的完成事件，归还其占用的缓冲区
+                        if (cqe->flags & IORING_CQE_F_BUFFER) {
+                            recycle(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+                        }
+                        // 发送期间被关闭的连接，内核不再访问响应，释放文件映射并关闭socket
+                        if (op == OP_SEND && !m_conns[fd].open && m_conns[fd].sending) {
+                            m_conns[fd].sending = false;
+                            finish_close(fd);
+                        }
+                    } else if (op == OP_RECV) {
+                        deal_recv(fd, cqe);
+                    } else {
+                        deal_send(fd, cqe);
+                    }
+                    break;
+                }
+            }
+            m_ring.cqe_seen();
+        }
+
+        // 有缓冲区归还时按先后顺序重新提交因缓冲区环为空而停止的recv，每归还一个缓冲区恢复一个连接
+        // 避免少量缓冲区归还时所有等待的连接一起提交又一起失败
+        while (m_recycled > 0 && !m_starved.empty()) {
+            int sockfd = m_starved.front();
+            m_starved.pop_front();
+            m_recycled--;
+            m_conns[sockfd].starved = false;
+            resume_recv(sockfd);
+        }
+        m_recycled = 0;
+
+        if (m_timeout) {
+            // 处理定时任务
+            timer_handler();
+            m_timeout = false;
+        }
+        // 本轮事件可能添加、延后或删除了定时器
+        update_timer();
+    }
+}
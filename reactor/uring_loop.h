@@ -0,0 +1,100 @@
+// 基于io_uring的事件循环，与epoll_loop共用http_conn的状态机和线程池
+// 监听socket上挂一个multishot accept，每个连接上挂一个multishot recv，数据直接读入内核从缓冲区环中挑选的缓冲区
+// 工作线程处理完请求后通过通知管道告知事件循环，由事件循环提交sendmsg请求
+// 所有请求的提交和完成的收割在一次io_uring_enter中完成，不再需要epoll_wait、recv、writev和epoll_ctl各一次系统调用
+#ifndef URING_LOOP_H
+#define URING_LOOP_H
+
+#include<vector>
+#include<deque>
+#include<sys/socket.h>
+#include<sys/uio.h>
+
+#include"event_loop.h"
+#include"uring.h"
+
+class uring_loop : public event_loop {
+    public:
+        uring_loop(http_conn* users, client_data* users_timer, threadpool<http_conn>* pool);
+        ~uring_loop();
+
+    protected:
+        void run();
+        void init_conn(int connfd, const sockaddr_in& addr);
+        void close_sock(int sockfd);
+        void deal_event(int sockfd, int ev);
+        void deal_close(int sockfd);
+        // 工作线程处理完了一个在处理期间被关闭的连接
+        void deal_stale(int sockfd);
+
+    private:
+        // 请求类型，与fd和连接代数一起编码在SQE的user_data中
+        enum URING_OP {OP_ACCEPT = 0, OP_RECV, OP_SEND, OP_NOTIFY, OP_SIGNAL, OP_TIMER, OP_CANCEL};
+
+        // 暂存的一块数据：缓冲区编号、尚未交给http_conn的数据的起始位置和长度
+        struct pending_buf {
+            unsigned short bid;
+            int offset;
+            int len;
+        };
+        // 每个连接在io_uring下的状态，以socket的fd为索引
+        struct conn_state {
+            // 连接代数，fd被关闭后可能立刻被新连接复用，代数不同的完成事件属于旧连接，直接丢弃
+            unsigned gen;
+            bool open;
+            // 连接正在被工作线程处理或正在发送响应，此时收到的数据先暂存起来
+            bool busy;
+            // 已经提交了sendmsg，还没有收到完成事件
+            bool sending;
+            // multishot recv仍在进行，收到不带IORING_CQE_F_MORE的完成事件后结束
+            bool recv_armed;
+            // 暂存的缓冲区达到上限，已经请求取消recv
+            bool recv_paused;
+            // recv因缓冲区环为空而结束，等有缓冲区归还后再重新提交
+            bool starved;
+            // 正在发送的HTTP响应，提交sendmsg后直到完成前内核都会访问
+            struct msghdr msg;
+            struct iovec iov[http_conn::WRITE_IOV_SIZE];
+            // 连接忙时收到的数据所在的缓冲区，读缓冲区放不下时剩余部分留在这里
+            std::vector<pending_buf> pending;
+        };
+
+        static unsigned long long make_data(int op, int fd, unsigned gen) {
+            return ((unsigned long long)gen << 32) | ((unsigned long long)fd << 8) | op;
+        }
+
+        void submit_accept();
+        void submit_recv(int sockfd);
+        // recv没有在进行、暂存的缓冲区没有达到上限且没有等待缓冲区时重新提交recv
+        void resume_recv(int sockfd);
+        // 取消连接上的multishot recv，暂存的缓冲区达到上限时调用
+        void pause_recv(int sockfd);
+        // 将缓冲区还给缓冲区环，并记录本轮归还的缓冲区数
+        void recycle(unsigned short bid);
+        void submit_read(int fd, int op, void* buf, int len);
+        // 提交发送HTTP响应的sendmsg请求
+        void submit_send(int sockfd);
+
+        void deal_accept(struct io_uring_cqe* cqe);
+        void deal_recv(int sockfd, struct io_uring_cqe* cqe);
+        void deal_send(int sockfd, struct io_uring_cqe* cqe);
+        // 把暂存的数据交给http_conn，并将连接放入请求队列
+        void flush_pending(int sockfd);
+        // HTTP响应发送完毕
+        void finish_send(int sockfd);
+        // 连接关闭后工作线程和内核都不再使用它时，释放文件映射和缓冲区并关闭socket
+        void finish_close(int sockfd);
+
+    private:
+        uring m_ring;
+        std::vector<conn_state> m_conns;
+        // 因缓冲区环为空而停止接收的连接，按归还的缓冲区数依次重新提交它们的recv
+        std::deque<int> m_starved;
+        // 本轮归还的缓冲区数
+        int m_recycled;
+        notify_msg m_notify_buf[64];
+        signalfd_siginfo m_signal_buf[16];
+        uint64_t m_timer_buf;
+};
+
+#endif
@@ -0,0 +1,296 @@
+// HTTP压测客户端，用于比较不同事件循环后端和配置处理同一负载的吞吐量
+// 建立num个keep-alive连接，每个连接收到完整响应后立即发送下一个请求，运行seconds秒后统计QPS
+// 指定-s时使用短连接，每个请求都新建一个连接，收到响应后关闭，用于测试服务器在连接频繁建立和关闭时的accept速率
+// 指定-d depth时每个连接同时保持depth个未完成的请求（HTTP/1.1 pipelining），收到一个响应就补发一个请求
+// 用法：./bench_client [-s] [-d depth] ip port num seconds [path ...]
+// 给出多个path时每个连接依次轮流请求它们，可以模拟小页面和大文件混合的负载
+// 例如分别以./run 9006和./run -u 9006启动服务器，用相同参数运行本程序进行对比
+// 服务器端每个请求的系统调用次数可以用strace -c -f -p `pidof run`统计
+#include<stdlib.h>
+#include<stdio.h>
+#include<assert.h>
+#include<unistd.h>
+#include<errno.h>
+#include<time.h>
+#include<sys/types.h>
+#include<sys/epoll.h>
+#include<fcntl.h>
+#include<sys/socket.h>
+#include<netinet/in.h>
+#include<arpa/inet.h>
+#include<string.h>
+#include<strings.h>
+#include<string>
+#include<vector>
+#include<algorithm>
+
+#define MAX_CONN 10000
+#define BUFFER_SIZE 65536
+#define MAX_DEPTH 64
+
+// 每个连接的响应解析状态
+struct conn {
+    int sockfd;
+    // 已读取的响应头
+    char header[4096];
+    int header_len;
+    // 响应体剩余的字节数，-1表示响应头还没有读完
+    long body_left;
+    // 每个未完成请求的发送时间，单位微秒，按发送顺序组成环形队列
+    long long start[MAX_DEPTH];
+    int start_head;
+    int inflight;
+    // 下一个请求的路径下标
+    int next_path;
+};
+
+static conn conns[MAX_CONN];
+static struct sockaddr_in server_address;
+// 是否使用短连接
+static bool short_conn = false;
+// 每个连接上同时未完成的请求数
+static int depth = 1;
+// 每个路径对应的请求报文
+static std::vector<std::string> requests_text;
+static long long requests = 0;
+static long long failed = 0;
+// 每个请求的延迟，单位微秒
+static std::vector<int> latencies;
+
+static long long now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+int setnoblocking(int fd) {
+    int old_option = fcntl(fd, F_GETFL);
+    int new_option = old_option | O_NONBLOCK;
+    fcntl(fd, F_SETFL, new_option);
+    return old_option;
+}
+
+// 发送一个完整的请求，请求很短，非阻塞socket的发送缓冲区足以一次写完
+bool send_request(conn* c) {
+    // 短连接的延迟从建立连接开始计算
+    if (!short_conn) {
+        c->start[(c->start_head + c->inflight) % MAX_DEPTH] = now_us();
+    }
+    c->inflight++;
+    const std::string& request = requests_text[c->next_path];
+    c->next_path = (c->next_path + 1) % requests_text.size();
+    return send(c->sockfd, request.data(), request.size(), 0) == (ssize_t)request.size();
+}
+
+// 处理读到的数据，完整地收到一个响应时返回这个响应在data中占用的字节数，剩下的数据属于后续的响应
+// 数据全部被消耗而响应仍不完整时返回-1
+int parse_response(conn* c, char* data, int len) {
+    int used = 0;
+    if (c->body_left < 0) {
+        int copy = len;
+        if (c->header_len + copy > (int)sizeof(c->header) - 1) {
+            copy = sizeof(c->header) - 1 - c->header_len;
+        }
+        memcpy(c->header + c->header_len, data, copy);
+        c->header_len += copy;
+        c->header[c->header_len] = '\0';
+        char* end = strstr(c->header, "\r\n\r\n");
+        if (!end) {
+            return -1;
+        }
+        int header_size = end + 4 - c->header;
+        long content_length = 0;
+        char* p = strcasestr(c->header, "Content-Length:");
+        if (p && p < end) {
+            content_length = atol(p + strlen("Content-Length:"));
+        }
+        // 本次读到的数据中除去响应头剩下的是响应体
+        used = header_size - (c->header_len - copy);
+        c->body_left = content_length;
+    }
+    long take = std::min(c->body_left, (long)(len - used));
+    c->body_left -= take;
+    used += take;
+    if (c->body_left > 0) {
+        return -1;
+    }
+    c->header_len = 0;
+    c->body_left = -1;
+    return used;
+}
+
+// 建立一个TCP连接，连接建立后再设为非阻塞
+bool open_conn(int epoll_fd, conn* c) {
+    c->start[0] = now_us();
+    c->start_head = 0;
+    c->inflight = 0;
+    c->header_len = 0;
+    c->body_left = -1;
+    int sockfd = socket(PF_INET, SOCK_STREAM, 0);
+    if (sockfd < 0) {
+        return false;
+    }
+    if (connect(sockfd, (struct sockaddr*)&server_address, sizeof(server_address)) != 0) {
+        close(sockfd);
+        return false;
+    }
+    setnoblocking(sockfd);
+    c->sockfd = sockfd;
+    epoll_event event;
+    event.data.ptr = c;
+    event.events = EPOLLIN | EPOLLET | EPOLLRDHUP;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sockfd, &event);
+    return true;
+}
+
+// 向服务器发起num个TCP连接
+int start_conn(int epoll_fd, int num) {
+    int count = 0;
+    for (int i = 0; i < num; i++) {
+        conn* c = &conns[count];
+        if (!open_conn(epoll_fd, c)) {
+            continue;
+        }
+        // 错开各连接的起始路径
+        c->next_path = count % requests_text.size();
+        count++;
+    }
+    return count;
+}
+
+// 关闭连接前删除epoll事件
+void close_conn(int epoll_fd, conn* c) {
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, c->sockfd, 0);
+    close(c->sockfd);
+    c->sockfd = -1;
+}
+
+int main(int argc, char* argv[]) {
+    int opt;
+    while ((opt = getopt(argc, argv, "sd:")) != -1) {
+        if (opt == 's') {
+            short_conn = true;
+        } else if (opt == 'd') {
+            depth = atoi(optarg);
+        }
+    }
+    if (argc - optind < 4 || depth < 1 || depth > MAX_DEPTH) {
+        printf("usage: %s [-s] [-d depth] ip port num seconds [path ...]\n", argv[0]);
+        return 1;
+    }
+    // 短连接每个连接只发送一个请求
+    if (short_conn) {
+        depth = 1;
+    }
+    const char* ip = argv[optind];
+    int port = atoi(argv[optind + 1]);
+    int num = atoi(argv[optind + 2]);
+    int seconds = atoi(argv[optind + 3]);
+    assert(num > 0 && num <= MAX_CONN && seconds > 0);
+    bzero(&server_address, sizeof(server_address));
+    server_address.sin_family = AF_INET;
+    inet_pton(AF_INET, ip, &server_address.sin_addr);
+    server_address.sin_port = htons(port);
+
+    std::vector<const char*> paths(argv + optind + 4, argv + argc);
+    if (paths.empty()) {
+        paths.push_back("/");
+    }
+    for (size_t i = 0; i < paths.size(); i++) {
+        char request[1024];
+        snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nHost: %s\r\nConnection: %s\r\n\r\n",
+                 paths[i], ip, short_conn ? "close" : "keep-alive");
+        requests_text.push_back(request);
+    }
+
+    int epoll_fd = epoll_create(100);
+    int alive = start_conn(epoll_fd, num);
+    printf("%d connections established\n", alive);
+
+    long long begin = now_us();
+    long long deadline = begin + (long long)seconds * 1000000;
+    for (int i = 0; i < alive; i++) {
+        for (int j = 0; j < depth; j++) {
+            if (!send_request(&conns[i])) {
+                failed++;
+                close_conn(epoll_fd, &conns[i]);
+                break;
+            }
+        }
+    }
+
+    epoll_event events[MAX_CONN];
+    static char buffer[BUFFER_SIZE];
+    while (alive > 0 && now_us() < deadline) {
+        int fds = epoll_wait(epoll_fd, events, MAX_CONN, 100);
+        for (int i = 0; i < fds; i++) {
+            conn* c = (conn*)events[i].data.ptr;
+            if (c->sockfd == -1) {
+                continue;
+            }
+            bool closed = false;
+            bool reconnected = false;
+            // ET模式，循环读完socket上的数据
+            while (true) {
+                int ret = recv(c->sockfd, buffer, BUFFER_SIZE, 0);
+                if (ret < 0) {
+                    closed = (errno != EAGAIN && errno != EWOULDBLOCK);
+                    break;
+                } else if (ret == 0) {
+                    closed = true;
+                    break;
+                }
+                // 一次读到的数据中可能包含多个流水线响应
+                char* data = buffer;
+                while (ret > 0 && !closed) {
+                    int used = parse_response(c, data, ret);
+                    if (used < 0) {
+                        break;
+                    }
+                    data += used;
+                    ret -= used;
+                    requests++;
+                    latencies.push_back(now_us() - c->start[c->start_head]);
+                    c->start_head = (c->start_head + 1) % MAX_DEPTH;
+                    c->inflight--;
+                    if (short_conn) {
+                        // 关闭连接并立刻建立新连接发送下一个请求
+                        close_conn(epoll_fd, c);
+                        closed = !open_conn(epoll_fd, c) || !send_request(c);
+                        reconnected = true;
+                        break;
+                    }
+                    // 收到完整响应后立刻发送下一个请求
+                    if (!send_request(c)) {
+                        closed = true;
+                    }
+                }
+                if (closed || reconnected) {
+                    break;
+                }
+            }
+            if (closed) {
+                failed++;
+                if (c->sockfd != -1) {
+                    close_conn(epoll_fd, c);
+                }
+                alive--;
+            }
+        }
+    }
+
+    double elapsed = (now_us() - begin) / 1000000.0;
+    printf("requests: %lld, failed connections: %lld, time: %.2fs\n", requests, failed, elapsed);
+    printf("QPS: %.0f\n", elapsed > 0 ? requests / elapsed : 0.0);
+    if (!latencies.empty()) {
+        std::sort(latencies.begin(), latencies.end());
+        long long total_latency = 0;
+        for (size_t i = 0; i < latencies.size(); i++) {
+            total_latency += latencies[i];
+        }
+        size_t n = latencies.size();
+        printf("latency: avg %lldus, p50 %dus, p90 %dus, p99 %dus, max %dus\n", total_latency / (long long)n,
+               latencies[n * 50 / 100], latencies[n * 90 / 100], latencies[n * 99 / 100], latencies[n - 1]);
+    }
+    return 0;
+}
@@ -0,0 +1,99 @@
+// 空文件回归测试：在一个keep-alive连接上流水线发送GET /empty.html和GET /
+// 空文件的响应应当是Content-Length为0、没有消息体的200响应，之后连接仍然可用，第二个请求也能收到200响应
+// 用法：./empty_file_test ip port，服务器的root目录下需要有空文件empty.html
+#include<stdlib.h>
+#include<stdio.h>
+#include<unistd.h>
+#include<sys/types.h>
+#include<sys/socket.h>
+#include<netinet/in.h>
+#include<arpa/inet.h>
+#include<string.h>
+#include<strings.h>
+
+#define BUFFER_SIZE 65536
+
+static const char* request = "GET /empty.html HTTP/1.1\r\nHost: localhost\r\nConnection: keep-alive\r\n\r\n"
+                             "GET / HTTP/1.1\r\nHost: localhost\r\nConnection: keep-alive\r\n\r\n";
+
+static char buffer[BUFFER_SIZE];
+static int buffer_len = 0;
+
+// 从buffer的start处解析一个完整的响应，返回响应的总长度，不完整时返回0
+static int parse_response(int start, int* status, long* content_length) {
+    char* head = buffer + start;
+    char* end = strstr(head, "\r\n\r\n");
+    if (!end) {
+        return 0;
+    }
+    *status = atoi(head + 9);
+    *content_length = -1;
+    for (char* line = strstr(head, "\r\n") + 2; line < end; line = strstr(line, "\r\n") + 2) {
+        if (strncasecmp(line, "Content-Length:", 15) == 0) {
+            *content_length = atol(line + 15);
+        }
+    }
+    int total = end + 4 - head;
+    if (*content_length > 0) {
+        total += *content_length;
+    }
+    return start + total <= buffer_len ? total : 0;
+}
+
+// 读取数据直到buffer的start处有一个完整的响应，连接关闭或超时返回0
+static int read_response(int sockfd, int start, int* status, long* content_length) {
+    while (true) {
+        int len = parse_response(start, status, content_length);
+        if (len > 0) {
+            return len;
+        }
+        if (buffer_len >= BUFFER_SIZE - 1) {
+            return 0;
+        }
+        int ret = recv(sockfd, buffer + buffer_len, BUFFER_SIZE - 1 - buffer_len, 0);
+        if (ret <= 0) {
+            return 0;
+        }
+        buffer_len += ret;
+        buffer[buffer_len] = '\0';
+    }
+}
+
+int main(int argc, char* argv[]) {
+    if (argc != 3) {
+        printf("usage: %s ip port\n", argv[0]);
+        return 1;
+    }
+    struct sockaddr_in address;
+    bzero(&address, sizeof(address));
+    address.sin_family = AF_INET;
+    inet_pton(AF_INET, argv[1], &address.sin_addr);
+    address.sin_port = htons(atoi(argv[2]));
+    int sockfd = socket(PF_INET, SOCK_STREAM, 0);
+    if (sockfd < 0 || connect(sockfd, (struct sockaddr*)&address, sizeof(address)) < 0) {
+        printf("connect failed\n");
+        return 1;
+    }
+    // 服务器关闭连接或不再响应时不会一直等待
+    struct timeval timeout = {3, 0};
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    if (send(sockfd, request, strlen(request), 0) != (ssize_t)strlen(request)) {
+        printf("send failed\n");
+        return 1;
+    }
+
+    int status;
+    long content_length;
+    int len = read_response(sockfd, 0, &status, &content_length);
+    if (len == 0 || status != 200 || content_length != 0) {
+        printf("FAIL: /empty.html status %d, Content-Length %ld\n", len ? status : 0, len ? content_length : -1);
+        return 1;
+    }
+    if (read_response(sockfd, len, &status, &content_length) == 0 || status != 200) {
+        printf("FAIL: connection unusable after /empty.html\n");
+        return 1;
+    }
+    close(sockfd);
+    printf("PASS\n");
+    return 0;
+}
@@ -0,0 +1,274 @@
+// HTTP请求解析的微基准测试，比较原来逐字节扫描加strpbrk、strspn、strncasecmp的实现和现在的实现
+// 现在的实现与http_conn相同：scan.h向量化查找行尾、分隔符和冒号，首部名用完美哈希识别，所有首部记入首部表
+// 请求取自常见浏览器发出的keep-alive请求，每次复制到读缓冲区后完整地解析一遍：按行切分、拆分请求行、识别首部名
+// 向量化查找分别测试逐字节、SSE2、AVX2三种实现，最后一行是服务器运行时实际选中的实现
+// 用法：./parse_bench [iterations]，默认每个请求解析1000000次
+#include<stdlib.h>
+#include<stdio.h>
+#include<string.h>
+#include<strings.h>
+#include<time.h>
+
+#include"../http/scan.h"
+#include"../http/header_table.h"
+
+static const char* requests[] = {
+    // Chrome打开首页，带有条件请求首部
+    "GET / HTTP/1.1\r\n"
+    "Host: 192.168.17.129:9006\r\n"
+    "Connection: keep-alive\r\n"
+    "Cache-Control: max-age=0\r\n"
+    "sec-ch-ua: \"Chromium\";v=\"118\", \"Google Chrome\";v=\"118\", \"Not=A?Brand\";v=\"99\"\r\n"
+    "sec-ch-ua-mobile: ?0\r\n"
+    "sec-ch-ua-platform: \"Windows\"\r\n"
+    "Upgrade-Insecure-Requests: 1\r\n"
+    "User-Agent: Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) "
+    "Chrome/118.0.0.0 Safari/537.36\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,image/apng,*/*;q=0.8,"
+    "application/signed-exchange;v=b3;q=0.7\r\n"
+    "Sec-Fetch-Site: none\r\n"
+    "Sec-Fetch-Mode: navigate\r\n"
+    "Sec-Fetch-User: ?1\r\n"
+    "Sec-Fetch-Dest: document\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n"
+    "If-None-Match: \"11e033-99e2-170819d7b9174200\"\r\n"
+    "If-Modified-Since: Thu, 04 Aug 2022 09:21:17 GMT\r\n"
+    "\r\n",
+    // Firefox加载页面中的图片
+    "GET /test1.jpg HTTP/1.1\r\n"
+    "Host: 192.168.17.129:9006\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:109.0) Gecko/20100101 Firefox/119.0\r\n"
+    "Accept: image/avif,image/webp,*/*\r\n"
+    "Accept-Language: zh-CN,zh;q=0.8,zh-TW;q=0.7,zh-HK;q=0.5,en-US;q=0.3,en;q=0.2\r\n"
+    "Accept-Encoding: gzip, deflate\r\n"
+    "Connection: keep-alive\r\n"
+    "Referer: http://192.168.17.129:9006/5\r\n"
+    "Sec-Fetch-Dest: image\r\n"
+    "Sec-Fetch-Mode: no-cors\r\n"
+    "Sec-Fetch-Site: same-origin\r\n"
+    "\r\n",
+    // 压测客户端的短请求
+    "GET /judge.html HTTP/1.1\r\n"
+    "Host: 192.168.17.129\r\n"
+    "Connection: keep-alive\r\n"
+    "\r\n",
+};
+
+// 解析结果，用于检查各实现的结果一致，同时避免解析被编译器优化掉
+struct result {
+    char* url;
+    char* version;
+    char* host;
+    bool linger;
+    int known;
+    int lines;
+};
+
+// 原来的实现：逐字节查找行尾，strpbrk和strspn拆分请求行，strncasecmp依次比较首部名
+static bool parse_old(char* buf, int len, result* res) {
+    int start = 0;
+    int i = 0;
+    memset(res, 0, sizeof(*res));
+    while (true) {
+        for (; i < len; i++) {
+            if (buf[i] == '\r' || buf[i] == '\n') {
+                break;
+            }
+        }
+        if (i + 1 >= len || buf[i] != '\r' || buf[i + 1] != '\n') {
+            return false;
+        }
+        buf[i++] = '\0';
+        buf[i++] = '\0';
+        char* text = buf + start;
+        start = i;
+        if (res->lines++ == 0) {
+            res->url = strpbrk(text, " \t");
+            if (!res->url) {
+                return false;
+            }
+            *res->url++ = '\0';
+            res->url += strspn(res->url, " \t");
+            res->version = strpbrk(res->url, " \t");
+            if (!res->version) {
+                return false;
+            }
+            *res->version++ = '\0';
+            res->version += strspn(res->version, " \t");
+        } else if (text[0] == '\0') {
+            return true;
+        } else if (strncasecmp(text, "Connection:", 11) == 0) {
+            text += 11;
+            text += strspn(text, " \t");
+            res->linger = strcasecmp(text, "keep-alive") == 0;
+        } else if (strncasecmp(text, "Content-Length:", 15) == 0) {
+            res->known++;
+        } else if (strncasecmp(text, "Host:", 5) == 0) {
+            text += 5;
+            text += strspn(text, " \t");
+            res->host = text;
+        } else if (strncasecmp(text, "If-None-Match:", 14) == 0 ||
+                   strncasecmp(text, "If-Modified-Since:", 18) == 0 ||
+                   strncasecmp(text, "Accept-Encoding:", 16) == 0 ||
+                   strncasecmp(text, "Range:", 6) == 0 ||
+                   strncasecmp(text, "If-Range:", 9) == 0) {
+            res->known++;
+        }
+    }
+}
+
+// 与http_conn相同的做法：向量化查找行尾、空白分隔符和冒号，首部记入首部表，解析完后按编号取值
+static bool parse_new(char* buf, int len, result* res, scan_any_func scan) {
+    static header_table headers;
+    char* p = buf;
+    char* end = buf + len;
+    memset(res, 0, sizeof(*res));
+    headers.clear();
+    while (true) {
+        char* line_end = (char*)scan(p, end, '\r', '\n');
+        if (line_end + 1 >= end || line_end[0] != '\r' || line_end[1] != '\n') {
+            return false;
+        }
+        line_end[0] = '\0';
+        line_end[1] = '\0';
+        char* text = p;
+        p = line_end + 2;
+        if (res->lines++ == 0) {
+            res->url = (char*)scan(text, line_end, ' ', '\t');
+            if (res->url == line_end) {
+                return false;
+            }
+            *res->url++ = '\0';
+            res->url = skip_space(res->url, line_end);
+            res->version = (char*)scan(res->url, line_end, ' ', '\t');
+            if (res->version == line_end) {
+                return false;
+            }
+            *res->version++ = '\0';
+            res->version = skip_space(res->version, line_end);
+            continue;
+        }
+        if (text == line_end) {
+            break;
+        }
+        char* colon = (char*)scan(text, line_end, ':', ':');
+        int name_len = colon - text;
+        char* value = skip_space(colon + (colon < line_end), line_end);
+        HEADER_ID id = find_header_id(text, name_len);
+        if (!headers.add(id, text - buf, name_len, value - buf, line_end - value)) {
+            return false;
+        }
+        if (id == HEADER_CONNECTION) {
+            res->linger = strcasecmp(value, "keep-alive") == 0;
+        }
+    }
+    const header_field* host = headers.find(HEADER_HOST);
+    res->host = host ? buf + host->value : NULL;
+    HEADER_ID known[] = {HEADER_CONTENT_LENGTH, HEADER_IF_NONE_MATCH, HEADER_IF_MODIFIED_SINCE, HEADER_ACCEPT_ENCODING,
+                         HEADER_RANGE, HEADER_IF_RANGE};
+    for (size_t i = 0; i < sizeof(known) / sizeof(known[0]); i++) {
+        res->known += headers.find(known[i]) != NULL;
+    }
+    return true;
+}
+
+static double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static const int REQUEST_COUNT = sizeof(requests) / sizeof(requests[0]);
+static char buffers[REQUEST_COUNT][2048];
+static int lengths[REQUEST_COUNT];
+static long checksum = 0;
+
+static void summarize(char* buf, const result& res) {
+    checksum += (res.url - buf) + (res.version - buf) + (res.host ? res.host - buf : 0) + res.linger + res.known +
+                res.lines;
+}
+
+// scan为NULL时测试原来的实现；每次解析前复制请求，与服务器读入数据后的状态相同
+static void bench(const char* name, scan_any_func scan, int iterations) {
+    char buf[2048];
+    result res;
+    printf("%-10s", name);
+    double total = 0;
+    for (int r = 0; r < REQUEST_COUNT; r++) {
+        double start = now_ns();
+        for (int i = 0; i < iterations; i++) {
+            memcpy(buf, buffers[r], lengths[r]);
+            bool ok = scan ? parse_new(buf, lengths[r], &res, scan) : parse_old(buf, lengths[r], &res);
+            if (ok) {
+                summarize(buf, res);
+            }
+        }
+        double ns = (now_ns() - start) / iterations;
+        total += ns;
+        printf(" %12.1f", ns);
+    }
+    printf(" %12.1f\n", total / REQUEST_COUNT);
+}
+
+// 所有实现的解析结果必须与原来的实现一致
+static bool check(scan_any_func scan) {
+    for (int r = 0; r < REQUEST_COUNT; r++) {
+        char a[2048], b[2048];
+        result x, y;
+        memcpy(a, buffers[r], lengths[r]);
+        memcpy(b, buffers[r], lengths[r]);
+        if (!parse_old(a, lengths[r], &x) || !parse_new(b, lengths[r], &y, scan) || strcmp(x.url, y.url) != 0 ||
+            strcmp(x.version, y.version) != 0 || strcmp(x.host, y.host) != 0 || x.linger != y.linger ||
+            x.known != y.known || x.lines != y.lines) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 1000000;
+    for (int r = 0; r < REQUEST_COUNT; r++) {
+        lengths[r] = strlen(requests[r]);
+        memcpy(buffers[r], requests[r], lengths[r]);
+    }
+
+    struct {
+        const char* name;
+        scan_any_func scan;
+    } impls[] = {
+        {"scalar", scan_any_scalar},
+#ifdef SCAN_X86
+        {"sse2", scan_any_sse2},
+        {"avx2", __builtin_cpu_supports("avx2") ? scan_any_avx2 : NULL},
+#endif
+        {"selected", scan_any},
+    };
+    int impl_count = sizeof(impls) / sizeof(impls[0]);
+    for (int i = 0; i < impl_count; i++) {
+        if (impls[i].scan && !check(impls[i].scan)) {
+            printf("%s: result differs from the original parser\n", impls[i].name);
+            return 1;
+        }
+    }
+
+    printf("ns per request\n%-10s", "impl");
+    for (int r = 0; r < REQUEST_COUNT; r++) {
+        char title[32];
+        snprintf(title, sizeof(title), "req%d(%dB)", r, lengths[r]);
+        printf(" %12s", title);
+    }
+    printf(" %12s\n", "average");
+    bench("original", NULL, iterations);
+    for (int i = 0; i < impl_count; i++) {
+        if (impls[i].scan) {
+            bench(impls[i].name, impls[i].scan, iterations);
+        }
+    }
+    // 防止解析结果被优化掉
+    if (checksum == 42) {
+        printf("%ld\n", checksum);
+    }
+    return 0;
+}
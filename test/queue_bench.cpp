@@ -0,0 +1,210 @@
+// 线程池请求队列的微基准测试，比较原来的std::list加互斥锁和信号量，与无锁MPMC环形队列加futex休眠
+// 生产者不断插入，消费者不断取出，队列满时生产者让出CPU后重试，队列空时消费者休眠等待唤醒
+// 分别测试1个生产者对N个消费者（与事件循环把连接交给线程池相同）和N个生产者对N个消费者，N从1增加到16
+// 两种队列的容量都与线程池默认的max_requests相同，输出每秒通过队列的任务数（百万）
+// 用法：./queue_bench [items]，默认每项测试传递2000000个任务
+#include<stdlib.h>
+#include<stdio.h>
+#include<time.h>
+#include<unistd.h>
+#include<sched.h>
+#include<list>
+#include<atomic>
+
+#include"../lock/locker.h"
+#include"../threadpool/mpmc_ring.h"
+
+static const int MAX_REQUESTS = 10000;
+
+struct item {
+    int value;
+};
+
+// 通知消费者退出的任务
+static item stop_item;
+
+// 原来的请求队列：每次插入分配一个链表节点，所有线程竞争一个互斥锁，消费者在信号量上等待
+class list_queue {
+    public:
+        bool push(item* request) {
+            locker_RAII lock_RAII(m_queuelocker);
+            if ((int)m_workqueue.size() > MAX_REQUESTS) {
+                return false;
+            }
+            m_workqueue.push_back(request);
+            m_queuestat.post();
+            return true;
+        }
+        item* pop() {
+            while (true) {
+                m_queuestat.wait();
+                locker_RAII lock_RAII(m_queuelocker);
+                if (m_workqueue.empty()) {
+                    continue;
+                }
+                item* request = m_workqueue.front();
+                m_workqueue.pop_front();
+                return request;
+            }
+        }
+
+    private:
+        std::list<item*> m_workqueue;
+        locker m_queuelocker;
+        sem m_queuestat;
+};
+
+// 与线程池MPMC_RING调度相同：无锁环形队列，消费者让出CPU几次仍取不到任务才休眠，生产者只在有休眠的消费者时唤醒
+class ring_queue {
+    public:
+        ring_queue(): m_ring(MAX_REQUESTS), m_idle(0) {}
+        bool push(item* request) {
+            if (!m_ring.push(request)) {
+                return false;
+            }
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (m_idle.load() > 0) {
+                m_wakeup.notify_one();
+            }
+            return true;
+        }
+        item* pop() {
+            while (true) {
+                item* request = m_ring.pop();
+                for (int i = 0; i < 4 && !request; i++) {
+                    sched_yield();
+                    request = m_ring.pop();
+                }
+                if (request) {
+                    return request;
+                }
+                m_idle.fetch_add(1);
+                int seq = m_wakeup.prepare();
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                request = m_ring.pop();
+                if (!request) {
+                    m_wakeup.wait(seq);
+                }
+                m_idle.fetch_sub(1);
+                if (request) {
+                    return request;
+                }
+            }
+        }
+
+    private:
+        mpmc_ring<item> m_ring;
+        std::atomic<int> m_idle;
+        event_count m_wakeup;
+};
+
+static item* items = NULL;
+
+template<typename Q>
+struct bench_arg {
+    Q* queue;
+    int begin;
+    int end;
+    long consumed;
+};
+
+template<typename Q>
+static void* produce(void* arg) {
+    bench_arg<Q>* a = (bench_arg<Q>*)arg;
+    for (int i = a->begin; i < a->end; i++) {
+        while (!a->queue->push(items + i)) {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+template<typename Q>
+static void* consume(void* arg) {
+    bench_arg<Q>* a = (bench_arg<Q>*)arg;
+    long sum = 0;
+    while (true) {
+        item* request = a->queue->pop();
+        if (request == &stop_item) {
+            break;
+        }
+        sum += request->value;
+    }
+    a->consumed = sum;
+    return NULL;
+}
+
+static double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// 返回每秒通过队列的任务数（百万），所有任务都被取出且恰好取出一次
+template<typename Q>
+static double bench(int producers, int consumers, int total) {
+    Q queue;
+    pthread_t threads[64];
+    bench_arg<Q> args[64];
+    double start = now_ns();
+    for (int i = 0; i < consumers; i++) {
+        args[i].queue = &queue;
+        pthread_create(threads + i, NULL, consume<Q>, args + i);
+    }
+    for (int i = 0; i < producers; i++) {
+        bench_arg<Q>& a = args[consumers + i];
+        a.queue = &queue;
+        a.begin = (long)total * i / producers;
+        a.end = (long)total * (i + 1) / producers;
+        pthread_create(threads + consumers + i, NULL, produce<Q>, &a);
+    }
+    for (int i = 0; i < producers; i++) {
+        pthread_join(threads[consumers + i], NULL);
+    }
+    for (int i = 0; i < consumers; i++) {
+        while (!queue.push(&stop_item)) {
+            sched_yield();
+        }
+    }
+    long sum = 0;
+    for (int i = 0; i < consumers; i++) {
+        pthread_join(threads[i], NULL);
+        sum += args[i].consumed;
+    }
+    double elapsed = now_ns() - start;
+    if (sum != (long)total) {
+        fprintf(stderr, "lost or duplicated items: %ld of %d\n", sum, total);
+        exit(1);
+    }
+    return total / elapsed * 1e3;
+}
+
+int main(int argc, char* argv[]) {
+    int total = argc > 1 ? atoi(argv[1]) : 2000000;
+    items = new item[total];
+    for (int i = 0; i < total; i++) {
+        items[i].value = 1;
+    }
+    printf("CPUs: %ld, items: %d\n", sysconf(_SC_NPROCESSORS_ONLN), total);
+    printf("Mitems/s  %12s %12s\n", "list", "ring");
+    const int counts[] = {1, 2, 4, 8, 16};
+    const int count_number = sizeof(counts) / sizeof(counts[0]);
+    for (int shared = 1; shared >= 0; shared--) {
+        for (int i = 0; i < count_number; i++) {
+            int n = counts[i];
+            int producers = shared ? 1 : n;
+            // 1:1已经测过
+            if (!shared && n == 1) {
+                continue;
+            }
+            char title[16];
+            snprintf(title, sizeof(title), "%d:%d", producers, n);
+            double list = bench<list_queue>(producers, n, total);
+            double ring = bench<ring_queue>(producers, n, total);
+            printf("%-9s %12.2f %12.2f\n", title, list, ring);
+            fflush(stdout);
+        }
+    }
+    delete []items;
+    return 0;
+}
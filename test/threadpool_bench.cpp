@@ -0,0 +1,244 @@
+// 线程池的扩展性基准测试，比较原来的单锁std::list队列和现在的工作窃取调度，工作线程数从1增加到64
+// inject：2个线程模拟事件循环不断插入任务，任务全部经过全局队列
+// spawn：任务在工作线程中执行完后插入后续任务，模拟同一连接上的连续请求，工作窃取时后续任务进入本线程的队列
+// 每个任务执行work次整数运算（默认200次，约几百纳秒），输出每秒完成的任务数（百万）
+// burst：一次插入2000个各阻塞1毫秒的任务，模拟数据库变慢时的突发请求，比较固定4个线程和4到64个线程的弹性线程池
+// 用法：./threadpool_bench [tasks] [work] > /dev/null，默认每项测试执行1000000个任务
+// 结果输出到标准错误，标准输出上是线程池创建线程时打印的信息
+#include<stdlib.h>
+#include<stdio.h>
+#include<time.h>
+#include<unistd.h>
+#include<list>
+#include<vector>
+#include<atomic>
+
+#include"../threadpool/threadpool.h"
+
+// 原来的线程池：所有线程竞争一个互斥锁保护的std::list，每次插入分配一个链表节点，用信号量等待任务
+template<typename T>
+class list_pool {
+    public:
+        list_pool(int thread_number, int max_requests): m_thread_number(thread_number),
+            m_max_requests(max_requests), m_stop(false) {
+            m_threads = new pthread_t[thread_number];
+            for (int i = 0; i < thread_number; i++) {
+                pthread_create(m_threads + i, NULL, worker, this);
+            }
+        }
+        ~list_pool() {
+            m_stop = true;
+            for (int i = 0; i < m_thread_number; i++) {
+                m_queuestat.post();
+            }
+            for (int i = 0; i < m_thread_number; i++) {
+                pthread_join(m_threads[i], NULL);
+            }
+            delete []m_threads;
+        }
+        bool append(T* request) {
+            locker_RAII lock_RAII(m_queuelocker);
+            if ((int)m_workqueue.size() > m_max_requests) {
+                return false;
+            }
+            m_workqueue.push_back(request);
+            m_queuestat.post();
+            return true;
+        }
+
+    private:
+        static void* worker(void* arg) {
+            list_pool* pool = (list_pool*)arg;
+            while (!pool->m_stop) {
+                pool->m_queuestat.wait();
+                T* request = NULL;
+                {
+                    locker_RAII lock_RAII(pool->m_queuelocker);
+                    if (pool->m_workqueue.empty()) {
+                        continue;
+                    }
+                    request = pool->m_workqueue.front();
+                    pool->m_workqueue.pop_front();
+                }
+                request->process();
+            }
+            return pool;
+        }
+
+        int m_thread_number;
+        int m_max_requests;
+        pthread_t* m_threads;
+        std::list<T*> m_workqueue;
+        locker m_queuelocker;
+        sem m_queuestat;
+        std::atomic<bool> m_stop;
+};
+
+struct task;
+// 当前测试的线程池的插入函数，spawn场景下任务用它插入后续任务
+static bool (*append_task)(task*) = NULL;
+static void* current_pool = NULL;
+static std::atomic<long> done(0);
+static int work = 200;
+// 任务阻塞的时间，单位微秒，只有burst场景不为0
+static int block_us = 0;
+
+struct task {
+    // 还要插入的后续任务数
+    int remaining;
+    unsigned value;
+
+    void process() {
+        unsigned x = value | 1;
+        for (int i = 0; i < work; i++) {
+            x ^= x << 13;
+            x ^= x >> 17;
+            x ^= x << 5;
+        }
+        value = x;
+        if (block_us > 0) {
+            usleep(block_us);
+        }
+        done.fetch_add(1, std::memory_order_relaxed);
+        if (remaining > 0) {
+            remaining--;
+            while (!append_task(this)) {
+                sched_yield();
+            }
+        }
+    }
+};
+
+template<typename P>
+static bool append_to(task* t) {
+    return ((P*)current_pool)->append(t);
+}
+
+static double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static const int PRODUCERS = 2;
+static std::vector<task> tasks;
+
+struct producer_arg {
+    int begin;
+    int end;
+};
+
+static void* produce(void* arg) {
+    producer_arg* range = (producer_arg*)arg;
+    for (int i = range->begin; i < range->end; i++) {
+        while (!append_task(&tasks[i])) {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+static void wait_done(long total) {
+    while (done.load() < total) {
+        usleep(100);
+    }
+}
+
+// 返回每秒完成的任务数（百万）
+template<typename P>
+static double bench_inject(P* pool, int total) {
+    tasks.assign(total, task());
+    done = 0;
+    current_pool = pool;
+    append_task = append_to<P>;
+    double start = now_ns();
+    pthread_t producers[PRODUCERS];
+    producer_arg ranges[PRODUCERS];
+    for (int i = 0; i < PRODUCERS; i++) {
+        ranges[i].begin = (long)total * i / PRODUCERS;
+        ranges[i].end = (long)total * (i + 1) / PRODUCERS;
+        pthread_create(producers + i, NULL, produce, ranges + i);
+    }
+    for (int i = 0; i < PRODUCERS; i++) {
+        pthread_join(producers[i], NULL);
+    }
+    wait_done(total);
+    return total / (now_ns() - start) * 1e3;
+}
+
+// 同时进行的任务链数为线程数的4倍，每条链上的任务依次插入
+template<typename P>
+static double bench_spawn(P* pool, int threads, int total) {
+    int chains = threads * 4;
+    tasks.assign(chains, task());
+    for (int i = 0; i < chains; i++) {
+        tasks[i].remaining = total / chains - 1;
+    }
+    done = 0;
+    current_pool = pool;
+    append_task = append_to<P>;
+    double start = now_ns();
+    for (int i = 0; i < chains; i++) {
+        while (!pool->append(&tasks[i])) {
+            sched_yield();
+        }
+    }
+    long expected = (long)(total / chains) * chains;
+    wait_done(expected);
+    return expected / (now_ns() - start) * 1e3;
+}
+
+// 返回全部完成的耗时（毫秒），peak为期间最多的工作线程数
+static double bench_burst(threadpool<task>* pool, int total, int* peak) {
+    tasks.assign(total, task());
+    done = 0;
+    current_pool = pool;
+    append_task = append_to<threadpool<task> >;
+    double start = now_ns();
+    for (int i = 0; i < total; i++) {
+        while (!pool->append(&tasks[i])) {
+            sched_yield();
+        }
+    }
+    *peak = pool->threads();
+    while (done.load() < total) {
+        usleep(100);
+        if (pool->threads() > *peak) {
+            *peak = pool->threads();
+        }
+    }
+    return (now_ns() - start) / 1e6;
+}
+
+int main(int argc, char* argv[]) {
+    int total = argc > 1 ? atoi(argv[1]) : 1000000;
+    work = argc > 2 ? atoi(argv[2]) : 200;
+    fprintf(stderr, "CPUs: %ld, tasks: %d, work: %d\n", sysconf(_SC_NPROCESSORS_ONLN), total, work);
+    fprintf(stderr, "Mtasks/s  %12s %12s %12s %12s\n", "list inject", "steal inject", "list spawn", "steal spawn");
+    const int thread_counts[] = {1, 2, 4, 8, 16, 32, 64};
+    for (size_t i = 0; i < sizeof(thread_counts) / sizeof(thread_counts[0]); i++) {
+        int threads = thread_counts[i];
+        double result[4];
+        {
+            list_pool<task> pool(threads, 10000);
+            result[0] = bench_inject(&pool, total);
+            result[2] = bench_spawn(&pool, threads, total);
+        }
+        {
+            threadpool<task> pool(threads, 10000);
+            result[1] = bench_inject(&pool, total);
+            result[3] = bench_spawn(&pool, threads, total);
+        }
+        fprintf(stderr, "%-9d %12.2f %12.2f %12.2f %12.2f\n", threads, result[0], result[1], result[2], result[3]);
+    }
+
+    block_us = 1000;
+    fprintf(stderr, "burst     %12s %12s\n", "ms", "peak threads");
+    for (int elastic = 0; elastic <= 1; elastic++) {
+        threadpool<task> pool(4, 10000, threadpool<task>::WORK_STEALING, elastic ? 64 : 0);
+        int peak = 0;
+        double elapsed = bench_burst(&pool, 2000, &peak);
+        fprintf(stderr, "%-9s %12.1f %12d\n", elastic ? "4..64" : "4", elapsed, peak);
+    }
+    return 0;
+}
@@ -0,0 +1,95 @@
+// 线程池压力测试，插入任务的线程和工作线程都远多于环形队列的槽位
+// 每个任务都必须被执行恰好一次，全部完成后等待处理的请求数回到0，否则输出FAIL
+// 用法：./threadpool_test [rounds] > /dev/null，默认两种调度方式各测试20轮，全部通过时输出PASS并返回0
+// 结果输出到标准错误，标准输出上是线程池创建线程时打印的信息
+#include<stdlib.h>
+#include<stdio.h>
+#include<time.h>
+#include<unistd.h>
+#include<sched.h>
+#include<vector>
+#include<atomic>
+
+#include"../threadpool/threadpool.h"
+
+// 队列名额，环形队列的容量向上取整为2的幂，即只有4个槽位
+static const int MAX_REQUESTS = 4;
+static const int WORKERS = 8;
+static const int PRODUCERS = 16;
+static const int TASKS_PER_PRODUCER = 20000;
+// 一轮测试最长的时间，单位毫秒，超过时认为有任务丢失
+static const int ROUND_LIMIT_MS = 20000;
+
+struct task {
+    std::atomic<int> runs;
+
+    void process() {
+        runs.fetch_add(1, std::memory_order_relaxed);
+        done.fetch_add(1, std::memory_order_release);
+    }
+
+    static std::atomic<long> done;
+};
+
+std::atomic<long> task::done(0);
+
+static threadpool<task>* pool = NULL;
+static std::vector<task> tasks(PRODUCERS * TASKS_PER_PRODUCER);
+
+static void* produce(void* arg) {
+    long id = (long)arg;
+    for (int i = 0; i < TASKS_PER_PRODUCER; i++) {
+        while (!pool->append(&tasks[id * TASKS_PER_PRODUCER + i])) {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+static long now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static bool run_round(threadpool<task>::SCHEDULER scheduler) {
+    for (size_t i = 0; i < tasks.size(); i++) {
+        tasks[i].runs = 0;
+    }
+    task::done = 0;
+    pool = new threadpool<task>(WORKERS, MAX_REQUESTS, scheduler);
+    pthread_t producers[PRODUCERS];
+    for (long i = 0; i < PRODUCERS; i++) {
+        pthread_create(producers + i, NULL, produce, (void*)i);
+    }
+    for (int i = 0; i < PRODUCERS; i++) {
+        pthread_join(producers[i], NULL);
+    }
+    long total = tasks.size();
+    long start = now_ms();
+    while (task::done.load(std::memory_order_acquire) < total && now_ms() - start < ROUND_LIMIT_MS) {
+        usleep(1000);
+    }
+    bool ok = task::done.load() == total && pool->pending() == 0;
+    for (size_t i = 0; ok && i < tasks.size(); i++) {
+        ok = tasks[i].runs.load() == 1;
+    }
+    if (!ok) {
+        fprintf(stderr, "FAIL: %ld of %ld tasks done, %d pending\n", task::done.load(), total, pool->pending());
+        // 丢失任务时等待处理的请求数不会回到0，工作线程无法退出，直接结束进程
+        exit(1);
+    }
+    pool->stop();
+    delete pool;
+    return ok;
+}
+
+int main(int argc, char* argv[]) {
+    int rounds = argc > 1 ? atoi(argv[1]) : 20;
+    for (int i = 0; i < rounds; i++) {
+        run_round(threadpool<task>::MPMC_RING);
+        run_round(threadpool<task>::WORK_STEALING);
+    }
+    fprintf(stderr, "PASS\n");
+    return 0;
+}
@@ -0,0 +1,94 @@
+// 时间轮回归测试，检查时间轮清空一段时间后再添加的定时器，以及仍在时间轮中时被再次添加或重复删除的定时器
+// 用法：./time_wheel_test，全部通过时输出PASS并返回0
+#include<stdlib.h>
+#include<stdio.h>
+#include<unistd.h>
+
+#include"../timer/lst_timer.h"
+#include"../timer/time_wheel.h"
+
+static int fired = 0;
+
+static void cb_func(client_data* user_data) {
+    fired++;
+}
+
+// 不断调用tick()直到定时器到期，返回到期时间与期望时间的差值，单位毫秒，超过limit毫秒仍未到期时返回-1
+static time_t wait_fired(time_wheel& wheel, time_t expect, int limit) {
+    int before = fired;
+    time_t start = get_ms();
+    while (fired == before) {
+        if (get_ms() - start > limit) {
+            return -1;
+        }
+        wheel.tick();
+        usleep(500);
+    }
+    return get_ms() - expect;
+}
+
+// 添加、删除后时间轮为空，空闲一段时间再添加定时器，时间轮的当前位置应当先同步到当前时间
+static bool test_add_after_idle() {
+    time_wheel wheel(1);
+    util_timer timer;
+    timer.cb_func = cb_func;
+    timer.user_data = NULL;
+    timer.expire = get_ms() + 100;
+    wheel.add_timer(&timer);
+    wheel.del_timer(&timer);
+    usleep(500000);
+
+    time_t now = get_ms();
+    timer.expire = now + 10;
+    wheel.add_timer(&timer);
+    // 当前位置过时时，定时器会被放到高层，下次tick的时间落在过去
+    time_t next = wheel.next_expire();
+    if (next < now || next > timer.expire + 1) {
+        printf("FAIL: next_expire %ld ms after now, expect about 10\n", (long)(next - now));
+        return false;
+    }
+    time_t late = wait_fired(wheel, timer.expire, 1000);
+    if (late < 0 || late > 20) {
+        printf("FAIL: timer fired %ld ms late\n", (long)late);
+        return false;
+    }
+    return wheel.next_expire() == -1;
+}
+
+// 仍在时间轮中的定时器再次添加时只移动位置，删除两次也只计数一次
+static bool test_readd_linked() {
+    time_wheel wheel(1);
+    util_timer timer;
+    timer.cb_func = cb_func;
+    timer.user_data = NULL;
+    time_t now = get_ms();
+    timer.expire = now + 10;
+    wheel.add_timer(&timer);
+    timer.expire = now + 30;
+    wheel.add_timer(&timer);
+    wheel.del_timer(&timer);
+    wheel.del_timer(&timer);
+    if (wheel.next_expire() != -1) {
+        printf("FAIL: wheel not empty after del_timer\n");
+        return false;
+    }
+    timer.expire = now + 30;
+    wheel.add_timer(&timer);
+    wheel.add_timer(&timer);
+    int before = fired;
+    time_t late = wait_fired(wheel, timer.expire, 1000);
+    usleep(50000);
+    wheel.tick();
+    if (late < 0 || fired != before + 1 || wheel.next_expire() != -1) {
+        printf("FAIL: re-added timer fired %d times\n", fired - before);
+        return false;
+    }
+    return true;
+}
+
+int main() {
+    bool ok = test_add_after_idle();
+    ok = test_readd_linked() && ok;
+    printf("%s\n", ok ? "PASS" : "FAIL");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,80 @@
+// 定时器容器的微基准测试，比较升序链表sort_timer_lst和分层时间轮time_wheel
+// 模拟服务器的用法：连接建立时添加定时器，每次有数据传输时把定时器延后，连接关闭时删除定时器
+// 用法：./timer_bench [adjust_number]，默认分别测试1000、10000、60000个定时器
+#include<stdlib.h>
+#include<stdio.h>
+#include<time.h>
+#include<vector>
+
+#include"../timer/lst_timer.h"
+#include"../timer/time_wheel.h"
+
+// 与服务器相同的超时时间，单位毫秒
+static const int TIMEOUT = 15000;
+
+static void cb_func(client_data* user_data) {
+}
+
+static double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+template<typename T>
+void bench(const char* name, int number, int adjust_number) {
+    T* timers = new T;
+    // 定时器容器不负责释放定时器，所有定时器预先分配
+    std::vector<util_timer> storage(number);
+    std::vector<util_timer*> nodes(number);
+    srand(number);
+    time_t base = get_ms();
+
+    // 连接陆续建立，后建立的连接超时时间更晚
+    double start = now_ns();
+    for (int i = 0; i < number; i++) {
+        util_timer* timer = &storage[i];
+        timer->cb_func = cb_func;
+        timer->user_data = NULL;
+        timer->expire = base + (time_t)i * TIMEOUT / number;
+        timers->add_timer(timer);
+        nodes[i] = timer;
+    }
+    double add_ns = (now_ns() - start) / number;
+
+    // 随机选择一个连接，把它的定时器延后到所有定时器之后
+    start = now_ns();
+    for (int i = 0; i < adjust_number; i++) {
+        util_timer* timer = nodes[rand() % number];
+        timer->expire = base + TIMEOUT + (time_t)i * TIMEOUT / adjust_number;
+        timers->adjust_timer(timer);
+    }
+    double adjust_ns = (now_ns() - start) / adjust_number;
+
+    // 按随机顺序关闭连接
+    for (int i = number - 1; i > 0; i--) {
+        int j = rand() % (i + 1);
+        util_timer* tmp = nodes[i];
+        nodes[i] = nodes[j];
+        nodes[j] = tmp;
+    }
+    start = now_ns();
+    for (int i = 0; i < number; i++) {
+        timers->del_timer(nodes[i]);
+    }
+    double del_ns = (now_ns() - start) / number;
+
+    printf("%-16s %8d %14.1f %14.1f %14.1f\n", name, number, add_ns, adjust_ns, del_ns);
+    delete timers;
+}
+
+int main(int argc, char* argv[]) {
+    int adjust_number = argc > 1 ? atoi(argv[1]) : 10000;
+    int numbers[] = {1000, 10000, 60000};
+    printf("%-16s %8s %14s %14s %14s\n", "container", "timers", "add(ns/op)", "adjust(ns/op)", "del(ns/op)");
+    for (int i = 0; i < 3; i++) {
+        bench<sort_timer_lst>("sort_timer_lst", numbers[i], adjust_number);
+        bench<time_wheel>("time_wheel", numbers[i], adjust_number);
+    }
+    return 0;
+}
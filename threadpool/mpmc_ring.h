@@ -0,0 +1,101 @@
+// 固定容量的无锁多生产者多消费者环形队列，算法来自Dmitry Vyukov的bounded MPMC queue
+// 每个槽位带有序号，生产者和消费者各自用CAS推进尾部和头部，然后只操作自己占到的槽位
+// 槽位按缓存行对齐，相邻槽位上的生产者和消费者不会伪共享；插入和取出都不分配内存
+#ifndef MPMC_RING_H
+#define MPMC_RING_H
+
+#include<atomic>
+#include<cstddef>
+#include<stdint.h>
+
+template<typename T>
+class mpmc_ring {
+    public:
+        // 容量向上取整为2的幂
+        explicit mpmc_ring(size_t capacity): m_head(0), m_tail(0) {
+            size_t size = 2;
+            while (size < capacity) {
+                size <<= 1;
+            }
+            m_mask = size - 1;
+            m_slots = new slot[size];
+            for (size_t i = 0; i < size; i++) {
+                m_slots[i].seq.store(i, std::memory_order_relaxed);
+                m_slots[i].item = NULL;
+            }
+        }
+        ~mpmc_ring() {
+            delete []m_slots;
+        }
+
+        size_t capacity() const {
+            return m_mask + 1;
+        }
+
+        // 队列满时返回false
+        bool push(T* item) {
+            size_t pos = m_tail.load(std::memory_order_relaxed);
+            slot* s;
+            while (true) {
+                s = &m_slots[pos & m_mask];
+                size_t seq = s->seq.load(std::memory_order_acquire);
+                intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+                if (diff == 0) {
+                    // 槽位空闲，占用它
+                    if (m_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                        break;
+                    }
+                } else if (diff < 0) {
+                    // 槽位上一轮的内容还没有被取走，队列已满
+                    return false;
+                } else {
+                    pos = m_tail.load(std::memory_order_relaxed);
+                }
+            }
+            s->item = item;
+            s->seq.store(pos + 1, std::memory_order_release);
+            return true;
+        }
+
+        // 队列为空时返回NULL
+        T* pop() {
+            size_t pos = m_head.load(std::memory_order_relaxed);
+            slot* s;
+            while (true) {
+                s = &m_slots[pos & m_mask];
+                size_t seq = s->seq.load(std::memory_order_acquire);
+                intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+                if (diff == 0) {
+                    if (m_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                        break;
+                    }
+                } else if (diff < 0) {
+                    // 槽位还没有写入，队列为空
+                    return NULL;
+                } else {
+                    pos = m_head.load(std::memory_order_relaxed);
+                }
+            }
+            T* item = s->item;
+            // 序号推进一轮，槽位留给下一轮的生产者
+            s->seq.store(pos + m_mask + 1, std::memory_order_release);
+            return item;
+        }
+
+    private:
+        struct alignas(64) slot {
+            std::atomic<size_t> seq;
+            T* item;
+        };
+
+        mpmc_ring(const mpmc_ring&);
+        mpmc_ring& operator=(const mpmc_ring&);
+
+        slot* m_slots;
+        size_t m_mask;
+        // 头部和尾部分别被消费者和生产者修改，放在不同的缓存行
+        alignas(64) std::atomic<size_t> m_head;
+        alignas(64) std::atomic<size_t> m_tail;
+};
+
+#endif
@@ -0,0 +1,48 @@
+// 请求的调度类别和各类别的统计
+// 请求解析完后按处理方式分类，每类由自己的线程池处理，有各自的工作线程和队列上限
+// 访问数据库等会阻塞的请求和即时压缩等耗CPU的请求不会占满处理静态资源的工作线程
+#ifndef REQUEST_CLASS_H
+#define REQUEST_CLASS_H
+
+#include<atomic>
+#include<time.h>
+
+enum REQUEST_CLASS {
+    // 静态资源等很快完成的请求，事件循环交给线程池的请求都先按这一类处理
+    CLASS_STATIC = 0,
+    // 需要访问数据库的请求
+    CLASS_DB,
+    // 需要即时压缩等大量计算的请求
+    CLASS_CPU,
+    CLASS_COUNT
+};
+
+static const char* const request_class_names[CLASS_COUNT] = {"static", "db", "cpu"};
+
+static inline long class_clock_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+// 一个类别在一个统计周期内的请求数、被拒绝的请求数、排队时间和处理时间，多个工作线程同时更新
+struct class_stats {
+    std::atomic<long> requests;
+    std::atomic<long> rejected;
+    std::atomic<long> wait_ns;
+    std::atomic<long> max_wait_ns;
+    std::atomic<long> service_ns;
+
+    class_stats(): requests(0), rejected(0), wait_ns(0), max_wait_ns(0), service_ns(0) {}
+
+    void record(long wait, long service) {
+        requests.fetch_add(1, std::memory_order_relaxed);
+        wait_ns.fetch_add(wait, std::memory_order_relaxed);
+        service_ns.fetch_add(service, std::memory_order_relaxed);
+        long max = max_wait_ns.load(std::memory_order_relaxed);
+        while (wait > max && !max_wait_ns.compare_exchange_weak(max, wait, std::memory_order_relaxed)) {
+        }
+    }
+};
+
+#endif
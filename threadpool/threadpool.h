@@ -1,125 +1,510 @@
 #ifndef THREADPOOL_H
 #define THREADPOOL_H
 
-#include<list>
 #include<cstdio>
 #include<exception>
+#include<atomic>
 #include<pthread.h>
+#include<sched.h>
+#include<time.h>
 
 #include"../lock/locker.h"
-#include"../CGImysql/sql_connection_pool.h"
+#include"work_stealing_queue.h"
+#include"mpmc_ring.h"
 
 // 线程池类，引入模板方便代码复用
-// 使用一个工作队列完全解除了主线程和工作线程的耦合关系
-// 主线程往工作队列中插入任务，工作线程通过竞争来取得任务并执行它
+// 使用工作队列完全解除了主线程和工作线程的耦合关系，主线程往工作队列中插入任务，工作线程取得任务并执行它
+// 采用工作窃取调度：每个工作线程有自己的无锁双端队列，工作线程插入的任务放入自己的队列，由自己优先执行
+// 其他线程插入的任务放入全局注入队列，工作线程一次从中取出一批放入自己的队列，减少对全局锁的竞争
+// 自己的队列和注入队列都为空时从其他工作线程的队列中窃取任务，仍然没有任务时在futex上休眠，有新任务时被唤醒
+// 也可以选用更轻量的调度：所有线程共用一个无锁环形队列，按先来先服务的顺序取任务
+// 弹性线程池的线程数在上下限之间变化：请求排队时间超过目标时由监控线程增加工作线程，工作线程空闲一段时间后退出
 template<typename T>
 class threadpool {
     public:
+        // 调度方式
+        enum SCHEDULER {WORK_STEALING = 0, MPMC_RING};
+        // 停止时如何处理队列中还没有处理的请求
+        enum SHUTDOWN_POLICY {ABANDON_QUEUE = 0, DRAIN_QUEUE};
+
         // thread_number代表线程池中线程的数量，max_requests代表请求队列中最多允许的等待处理的请求的数量
-        threadpool(connection_pool* conn_pool, int thread_number = 8, int max_requests = 10000);
+        // max_threads大于thread_number时为弹性线程池，thread_number为线程数下限，max_threads为上限
+        // 线程池不为请求分配数据库连接，需要数据库的请求在处理时自己从数据库连接池获取
+        threadpool(int thread_number = 8, int max_requests = 10000, SCHEDULER scheduler = WORK_STEALING,
+                   int max_threads = 0);
         ~threadpool();
 
-        // 往请求队列中添加任务
+        // 往请求队列中添加任务，等待处理的请求数达到上限或线程池已经停止时返回false
         bool append(T* request);
+        // 停止接受新任务，唤醒所有工作线程并等待它们退出，之后append()都返回false，可以重复调用
+        // ABANDON_QUEUE时工作线程处理完手上的请求就退出，DRAIN_QUEUE时处理完队列中所有的请求再退出
+        // 多个线程池之间互相转交请求时，先停止所有线程池再析构，避免向已经释放的线程池添加请求
+        void stop(SHUTDOWN_POLICY policy = ABANDON_QUEUE);
+        // 等待处理的请求数，只用于统计，返回时可能已经变化
+        int pending() const {
+            return m_pending.load(std::memory_order_relaxed);
+        }
+        // 当前的工作线程数，只用于统计
+        int threads() const {
+            return m_live.load(std::memory_order_relaxed);
+        }
 
     private:
+        // 一次从注入队列中最多取出的任务数
+        static const int INJECT_BATCH = 16;
+        // 休眠前让出CPU等待新任务的次数，任务密集到达时工作线程不必每次都休眠再被唤醒
+        static const int PARK_SPIN = 4;
+        // 弹性线程池中请求排队超过该时间时增加一个工作线程，单位纳秒
+        static const long GROW_WAIT_NS = 1000000;
+        // 弹性线程池中工作线程休眠超过该时间仍没有任务，且线程数多于下限时退出，单位毫秒
+        static const int IDLE_TIMEOUT_MS = 10000;
+
+        // 每个工作线程的数据，队列按缓存行对齐，不同线程的队列不会伪共享
+        struct worker_data {
+            work_stealing_queue<T> queue;
+            threadpool* pool;
+            pthread_t thread;
+            // 选择窃取对象的随机数种子
+            unsigned seed;
+            // 线程已经创建且还没有被join，由m_resize_lock保护
+            bool joinable;
+            // 线程正在运行，退出前置为false，槽位可以给新线程使用，由m_resize_lock保护
+            bool running;
+        };
+
         // 工作线程运行的函数，它从工作队列中取出任务并执行
-        static void* worker(void *arg);
-        void run();
+        static void* worker(void* arg);
+        void run(worker_data* self);
+        // 依次从自己的队列、注入队列和其他工作线程的队列中取任务，都没有时返回NULL
+        T* find_task(worker_data* self);
+        T* take_injected(worker_data* self);
+        T* steal_task(worker_data* self);
+        // 没有等待处理的请求时休眠；弹性线程池中空闲超时的工作线程退出时返回true
+        bool park(worker_data* self);
+        // 有休眠的工作线程时唤醒一个
+        void wake_one();
+        // 在第index个槽位上创建工作线程，需要持有m_resize_lock
+        bool spawn(int index);
+        // 线程数没有达到上限时增加一个工作线程，只在监控线程中调用
+        void grow();
+        // 请求监控线程增加一个工作线程；创建和回收线程较慢，不能在插入任务的事件循环线程中进行
+        void request_grow();
+        // 弹性线程池的监控线程，负责增加工作线程和回收已经退出的工作线程
+        static void* monitor(void* arg);
+        void run_monitor();
+        // 线程数多于下限时当前工作线程退出，返回是否退出
+        bool retire(worker_data* self);
+        // 排队时间探针：插入或取出任务时没有进行中的探针，就以队尾的任务为探针，记下当前时间和取完它需要的累计取出数
+        // 取出的任务数达到探针的序号时，探针前面的任务都已经被取走，至今的时间就是排队时间
+        // 探针完成时排队超过目标，或者还没有完成就已经超过目标（例如工作线程都阻塞了），都增加一个线程
+        void watch_append(int ahead);
+        void watch_take();
+        void watch_probe(long taken, int ahead);
+        static long clock_ns() {
+            struct timespec ts;
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            return ts.tv_sec * 1000000000L + ts.tv_nsec;
+        }
 
-        // 线程池中的线程数
+        // 线程池中的线程数，弹性线程池中为下限
         int m_thread_number;
+        // 弹性线程池中的线程数上限，不是弹性线程池时与m_thread_number相同
+        int m_max_threads;
+        bool m_elastic;
         // 请求队列中允许的最大请求数
         int m_max_requests;
-        // 描述线程池的数组，其大小为m_thread_number;
-        pthread_t* m_threads;
-        // 请求队列
-        std::list<T*> m_workqueue;
-        // 请求队列的互斥锁
-        locker m_queuelocker;
-        // 是否有任务需要处理的信号量
-        sem m_queuestat;
+        // 每个工作线程的数据，其大小为m_max_threads
+        worker_data* m_workers;
+        // 当前线程对应的工作线程，不是本线程池的工作线程时为NULL
+        static thread_local worker_data* t_worker;
+        SCHEDULER m_scheduler;
+        // MPMC_RING调度时所有线程共用的环形队列，容量不小于m_max_requests
+        mpmc_ring<T>* m_ring;
+
+        // 注入队列，容量为m_max_requests的环形缓冲区，插入任务时不分配内存
+        T** m_inject;
+        int m_inject_head;
+        int m_inject_count;
+        // 注入队列的互斥锁
+        locker m_inject_lock;
+        // 所有队列中等待处理的请求数，也用于判断工作线程能否休眠
+        alignas(64) std::atomic<int> m_pending;
+        // 正在休眠或准备休眠的工作线程数
+        alignas(64) std::atomic<int> m_idle;
+        // 空闲的工作线程在它上面休眠
+        event_count m_wakeup;
+        // 当前的工作线程数和用过的槽位数，窃取时只遍历用过的槽位
+        std::atomic<int> m_live;
+        std::atomic<int> m_slots;
+        // 创建和退出工作线程时加锁
+        locker m_resize_lock;
+        // 监控线程，只有弹性线程池才有
+        pthread_t m_monitor;
+        bool m_monitor_started;
+        // 有增加线程的请求时唤醒监控线程，m_grow_pending合并监控线程处理之前的重复请求
+        sem m_grow_sem;
+        std::atomic<bool> m_grow_pending;
+        // 弹性线程池中累计取出的任务数，以及进行中的探针的序号（0表示没有）和插入时间
+        alignas(64) std::atomic<long> m_taken;
+        alignas(64) std::atomic<long> m_probe_ticket;
+        std::atomic<long> m_probe_time;
+        // 不再接受新任务
+        std::atomic<bool> m_closed;
         // 是否结束线程
-        bool m_stop;
-        // 数据库
-        connection_pool* m_conn_pool;
+        std::atomic<bool> m_stop;
 };
 
 template<typename T>
-threadpool<T>::threadpool(connection_pool* conn_pool, int thread_number, int max_requests):
-    m_conn_pool(conn_pool), m_thread_number(thread_number), m_max_requests(max_requests), m_stop(false), m_threads(NULL) {
+thread_local typename threadpool<T>::worker_data* threadpool<T>::t_worker = NULL;
+
+template<typename T>
+threadpool<T>::threadpool(int thread_number, int max_requests, SCHEDULER scheduler, int max_threads):
+    m_thread_number(thread_number), m_max_threads(max_threads > thread_number ? max_threads : thread_number),
+    m_elastic(max_threads > thread_number), m_max_requests(max_requests), m_workers(NULL),
+    m_scheduler(scheduler), m_ring(NULL), m_inject(NULL), m_inject_head(0), m_inject_count(0), m_pending(0),
+    m_idle(0), m_live(0), m_slots(0), m_monitor_started(false), m_grow_pending(false), m_taken(0),
+    m_probe_ticket(0), m_probe_time(0), m_closed(false), m_stop(false) {
     if ((thread_number <= 0) || (max_requests <= 0)) {
         throw std::exception();
     }
 
-    m_threads = new pthread_t[m_thread_number];
-    if (!m_threads) {
-        throw std::exception();
+    m_workers = new worker_data[m_max_threads];
+    if (m_scheduler == MPMC_RING) {
+        m_ring = new mpmc_ring<T>(m_max_requests);
+    } else {
+        m_inject = new T*[m_max_requests];
+    }
+    for (int i = 0; i < m_max_threads; i++) {
+        m_workers[i].pool = this;
+        m_workers[i].seed = i * 2654435761u + 1;
+        m_workers[i].joinable = false;
+        m_workers[i].running = false;
     }
 
-    // 创建thread_number个线程并设置为脱离线程
-    for (int i = 0; i < thread_number; i++) {
+    // 创建thread_number个线程，停止时唤醒并等待它们退出
+    bool created = true;
+    m_resize_lock.lock();
+    for (int i = 0; i < thread_number && created; i++) {
         printf("creating the %dth thread\n", i);
-        if (pthread_create(m_threads + i, NULL, worker, this) != 0) {
-            delete []m_threads;
-            throw std::exception();
-        }
-        if (pthread_detach(m_threads[i])) {
-            delete []m_threads;
-            throw std::exception();
-        }
+        created = spawn(i);
+    }
+    m_resize_lock.unlock();
+    if (created && m_elastic) {
+        created = pthread_create(&m_monitor, NULL, monitor, this) == 0;
+        m_monitor_started = created;
+    }
+    if (!created) {
+        stop();
+        delete []m_workers;
+        delete []m_inject;
+        delete m_ring;
+        throw std::exception();
     }
 }
 
 template<typename T>
 threadpool<T>::~threadpool() {
-    delete []m_threads;
-    m_stop = true;
+    stop();
+    delete []m_workers;
+    delete []m_inject;
+    delete m_ring;
+}
+
+template<typename T>
+void threadpool<T>::stop(SHUTDOWN_POLICY policy) {
+    if (m_closed.exchange(true)) {
+        return;
+    }
+    if (policy == ABANDON_QUEUE) {
+        m_stop = true;
+    }
+    m_wakeup.notify_all();
+    if (m_monitor_started) {
+        m_grow_sem.post();
+        pthread_join(m_monitor, NULL);
+        m_monitor_started = false;
+    }
+    // grow()持有锁时检查m_closed，拿到一次锁之后不会再创建线程；join时不能持有锁，退出中的线程还要用它
+    int slots;
+    {
+        locker_RAII lock_RAII(m_resize_lock);
+        slots = m_slots.load();
+    }
+    for (int i = 0; i < slots; i++) {
+        if (m_workers[i].joinable) {
+            pthread_join(m_workers[i].thread, NULL);
+            m_workers[i].joinable = false;
+        }
+    }
 }
 
 template<typename T>
 bool threadpool<T>::append(T* request) {
-    // 操作工作队列时一定要加锁，因为它被所有线程共享
-    locker_RAII lock_RAII(m_queuelocker);
-    if (m_workqueue.size() > m_max_requests) {
+    if (m_closed) {
         return false;
     }
-    m_workqueue.push_back(request);
-    // 信号量加一，代表工作队列有待处理的任务
-    m_queuestat.post();
+    // 先占用一个名额，注入队列和环形队列的容量都不小于名额总数，占到名额后一定放得下
+    int ahead = m_pending.fetch_add(1);
+    if (ahead >= m_max_requests) {
+        m_pending.fetch_sub(1);
+        return false;
+    }
+    worker_data* self = t_worker;
+    if (m_scheduler == MPMC_RING) {
+        // 消费者取得上一轮的槽位后还没来得及更新序号时push()也会返回false，名额保证了容量，稍等即可放入
+        while (!m_ring->push(request)) {
+            sched_yield();
+        }
+    } else if (!self || self->pool != this || !self->queue.push(request)) {
+        // 操作注入队列时一定要加锁，因为它被所有线程共享
+        locker_RAII lock_RAII(m_inject_lock);
+        m_inject[(m_inject_head + m_inject_count) % m_max_requests] = request;
+        m_inject_count++;
+    }
+    // 与park()中先增加m_idle再检查m_pending相对应，两边至少有一边能看到对方的修改，不会漏掉唤醒
+    if (m_idle.load() > 0) {
+        wake_one();
+    }
+    if (m_elastic) {
+        watch_append(ahead);
+    }
     return true;
 }
 
 template<typename T>
 void* threadpool<T>::worker(void* arg) {
-    threadpool* pool = (threadpool*)arg;
-    pool->run();
-    return pool;
+    worker_data* self = (worker_data*)arg;
+    t_worker = self;
+    self->pool->run(self);
+    return self->pool;
 }
 
 template<typename T>
-void threadpool<T>::run() {
+void threadpool<T>::run(worker_data* self) {
     while (!m_stop) {
-        // 工作线程通过竞争来取得任务并执行
-        // 信号量减一
-        m_queuestat.wait();
-        // 操作工作队列时一定要加锁，因为它被所有线程共享
-        locker_RAII lock_RAII(m_queuelocker);
-        if (m_workqueue.empty()) {
+        T* request = find_task(self);
+        if (!request) {
+            // 按DRAIN_QUEUE停止时队列中的请求都处理完才退出
+            if (m_closed && m_pending.load() == 0) {
+                return;
+            }
+            if (park(self)) {
+                return;
+            }
             continue;
         }
+        m_pending.fetch_sub(1);
+        // 还有等待处理的请求时叫醒一个休眠的同伴，由它去窃取，避免一个线程取了一批任务而其他线程都在休眠
+        if (m_pending.load() > 0 && m_idle.load() > 0) {
+            wake_one();
+        }
+        if (m_elastic) {
+            watch_take();
+        }
+        // 处理客户请求
+        request->process();
+    }
+}
 
-        T* request = m_workqueue.front();
-        m_workqueue.pop_front();
-        if (!request) {
+template<typename T>
+T* threadpool<T>::find_task(worker_data* self) {
+    if (m_scheduler == MPMC_RING) {
+        return m_ring->pop();
+    }
+    T* request = self->queue.pop();
+    if (!request) {
+        request = take_injected(self);
+    }
+    if (!request) {
+        request = steal_task(self);
+    }
+    return request;
+}
+
+// 取出注入队列中的一个任务执行，再按线程数平分取出一批放入自己的队列，其他线程可以从中窃取
+template<typename T>
+T* threadpool<T>::take_injected(worker_data* self) {
+    locker_RAII lock_RAII(m_inject_lock);
+    if (m_inject_count == 0) {
+        return NULL;
+    }
+    int batch = m_inject_count / m_live.load(std::memory_order_relaxed) + 1;
+    if (batch > INJECT_BATCH) {
+        batch = INJECT_BATCH;
+    }
+    T* request = m_inject[m_inject_head];
+    m_inject_head = (m_inject_head + 1) % m_max_requests;
+    m_inject_count--;
+    for (int i = 1; i < batch && m_inject_count > 0; i++) {
+        if (!self->queue.push(m_inject[m_inject_head])) {
+            break;
+        }
+        m_inject_head = (m_inject_head + 1) % m_max_requests;
+        m_inject_count--;
+    }
+    return request;
+}
+
+// 从随机选定的工作线程开始依次尝试窃取，已经退出的工作线程的队列一定为空
+template<typename T>
+T* threadpool<T>::steal_task(worker_data* self) {
+    int slots = m_slots.load(std::memory_order_acquire);
+    self->seed = self->seed * 1103515245u + 12345u;
+    int start = (self->seed >> 16) % slots;
+    for (int i = 0; i < slots; i++) {
+        worker_data* victim = m_workers + (start + i) % slots;
+        if (victim == self) {
+            continue;
+        }
+        T* request = victim->queue.steal();
+        if (request) {
+            return request;
+        }
+    }
+    return NULL;
+}
+
+template<typename T>
+bool threadpool<T>::park(worker_data* self) {
+    // 还有请求没有被取走，可能正在从注入队列移到某个线程的队列中，让出CPU后重新查找
+    if (m_pending.load() > 0) {
+        sched_yield();
+        return false;
+    }
+    for (int i = 0; i < PARK_SPIN; i++) {
+        sched_yield();
+        if (m_pending.load() > 0 || m_closed) {
+            return false;
+        }
+    }
+    m_idle.fetch_add(1);
+    int seq = m_wakeup.prepare();
+    bool woken = true;
+    if (!m_closed && m_pending.load() == 0) {
+        if (m_elastic) {
+            woken = m_wakeup.wait(seq, IDLE_TIMEOUT_MS);
+        } else {
+            m_wakeup.wait(seq);
+        }
+    }
+    m_idle.fetch_sub(1);
+    // 空闲超时后仍没有请求，多于下限的线程退出；自己的队列为空才会休眠，退出后其他线程不会漏掉任务
+    return !woken && m_pending.load() == 0 && retire(self);
+}
+
+template<typename T>
+void threadpool<T>::wake_one() {
+    m_wakeup.notify_one();
+}
+
+template<typename T>
+bool threadpool<T>::spawn(int index) {
+    worker_data* slot = m_workers + index;
+    // 槽位上退出的线程已经不再访问线程池，回收它之后再使用槽位
+    if (slot->joinable) {
+        pthread_join(slot->thread, NULL);
+        slot->joinable = false;
+    }
+    // 先增加线程数和槽位数，新线程取任务时已经能看到自己的槽位
+    slot->running = true;
+    m_live.fetch_add(1);
+    if (index >= m_slots.load()) {
+        m_slots.store(index + 1, std::memory_order_release);
+    }
+    if (pthread_create(&slot->thread, NULL, worker, slot) != 0) {
+        slot->running = false;
+        m_live.fetch_sub(1);
+        return false;
+    }
+    slot->joinable = true;
+    return true;
+}
+
+template<typename T>
+void threadpool<T>::grow() {
+    locker_RAII lock_RAII(m_resize_lock);
+    if (m_closed || m_live.load() >= m_max_threads) {
+        return;
+    }
+    for (int i = 0; i < m_max_threads; i++) {
+        if (!m_workers[i].running) {
+            if (spawn(i)) {
+                printf("threadpool grows to %d threads\n", m_live.load());
+            }
+            return;
+        }
+    }
+}
+
+template<typename T>
+void threadpool<T>::request_grow() {
+    if (!m_grow_pending.exchange(true)) {
+        m_grow_sem.post();
+    }
+}
+
+template<typename T>
+void* threadpool<T>::monitor(void* arg) {
+    threadpool* pool = (threadpool*)arg;
+    pool->run_monitor();
+    return pool;
+}
+
+template<typename T>
+void threadpool<T>::run_monitor() {
+    while (true) {
+        if (!m_grow_sem.wait()) {
             continue;
         }
+        if (m_closed) {
+            return;
+        }
+        // 先清除标记，增加线程期间的新请求会再唤醒一次
+        m_grow_pending.store(false);
+        grow();
+    }
+}
 
-        connection_RAII mysqlcon(&request->mysql, m_conn_pool);
+template<typename T>
+bool threadpool<T>::retire(worker_data* self) {
+    locker_RAII lock_RAII(m_resize_lock);
+    if (m_closed || m_live.load() <= m_thread_number) {
+        return false;
+    }
+    self->running = false;
+    m_live.fetch_sub(1);
+    printf("threadpool shrinks to %d threads\n", m_live.load());
+    return true;
+}
 
-        // 处理客户请求
-        request->process();
+template<typename T>
+void threadpool<T>::watch_append(int ahead) {
+    // 刚插入的任务在队尾，它前面有ahead个任务
+    watch_probe(m_taken.load(std::memory_order_relaxed), ahead + 1);
+}
+
+template<typename T>
+void threadpool<T>::watch_take() {
+    long taken = m_taken.fetch_add(1, std::memory_order_relaxed) + 1;
+    // 一次插入大量任务时插入方只放下第一个探针，之后由工作线程接着测量
+    watch_probe(taken, m_pending.load(std::memory_order_relaxed));
+}
+
+template<typename T>
+void threadpool<T>::watch_probe(long taken, int ahead) {
+    long ticket = m_probe_ticket.load(std::memory_order_acquire);
+    if (ticket == 0) {
+        if (ahead > 0) {
+            m_probe_time.store(clock_ns(), std::memory_order_relaxed);
+            m_probe_ticket.compare_exchange_strong(ticket, taken + ahead, std::memory_order_release);
+        }
+        return;
+    }
+    long wait = clock_ns() - m_probe_time.load(std::memory_order_relaxed);
+    if ((taken >= ticket || wait > GROW_WAIT_NS) && m_probe_ticket.compare_exchange_strong(ticket, 0) &&
+        wait > GROW_WAIT_NS) {
+        request_grow();
     }
 }
 
-#endif
\ No newline at end of file
+#endif
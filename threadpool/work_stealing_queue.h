@@ -0,0 +1,86 @@
+// 工作窃取线程池中每个工作线程自己的任务队列，Chase-Lev双端队列
+// 所属线程在底部push和pop，不需要加锁；其他线程空闲时从顶部steal，只有取最后一个任务时才与所属线程竞争
+// 容量固定，push满时返回false，由调用者把任务放入全局队列
+// 内存序按照Lê等人在"Correct and Efficient Work-Stealing for Weak Memory Models"中给出的C11实现
+#ifndef WORK_STEALING_QUEUE_H
+#define WORK_STEALING_QUEUE_H
+
+#include<atomic>
+#include<cstddef>
+
+template<typename T>
+class work_stealing_queue {
+    public:
+        // 容量，必须是2的幂
+        static const long CAPACITY = 256;
+
+        work_stealing_queue(): m_top(0), m_bottom(0) {
+            for (long i = 0; i < CAPACITY; i++) {
+                m_items[i].store(NULL, std::memory_order_relaxed);
+            }
+        }
+
+        // 只能由所属线程调用，队列满时返回false
+        bool push(T* item) {
+            long b = m_bottom.load(std::memory_order_relaxed);
+            long t = m_top.load(std::memory_order_acquire);
+            if (b - t >= CAPACITY) {
+                return false;
+            }
+            m_items[b & (CAPACITY - 1)].store(item, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            m_bottom.store(b + 1, std::memory_order_relaxed);
+            return true;
+        }
+
+        // 只能由所属线程调用，取出最后放入的任务，队列为空时返回NULL
+        T* pop() {
+            long b = m_bottom.load(std::memory_order_relaxed) - 1;
+            m_bottom.store(b, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            long t = m_top.load(std::memory_order_relaxed);
+            if (t > b) {
+                m_bottom.store(b + 1, std::memory_order_relaxed);
+                return NULL;
+            }
+            T* item = m_items[b & (CAPACITY - 1)].load(std::memory_order_relaxed);
+            if (t == b) {
+                // 只剩最后一个任务，与窃取者竞争top
+                if (!m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                    item = NULL;
+                }
+                m_bottom.store(b + 1, std::memory_order_relaxed);
+            }
+            return item;
+        }
+
+        // 任何线程都可以调用，取出最早放入的任务；队列为空或与其他线程竞争失败时返回NULL
+        T* steal() {
+            long t = m_top.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            long b = m_bottom.load(std::memory_order_acquire);
+            if (t >= b) {
+                return NULL;
+            }
+            T* item = m_items[t & (CAPACITY - 1)].load(std::memory_order_relaxed);
+            if (!m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                return NULL;
+            }
+            return item;
+        }
+
+        // 队列中的任务数，其他线程读到的只是近似值
+        long size() const {
+            long b = m_bottom.load(std::memory_order_relaxed);
+            long t = m_top.load(std::memory_order_relaxed);
+            return b > t ? b - t : 0;
+        }
+
+    private:
+        // top被窃取者修改，bottom被所属线程修改，分别放在不同的缓存行避免伪共享
+        alignas(64) std::atomic<long> m_top;
+        alignas(64) std::atomic<long> m_bottom;
+        alignas(64) std::atomic<T*> m_items[CAPACITY];
+};
+
+#endif
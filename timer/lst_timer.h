@@ -2,26 +2,29 @@
 #define LST_TIMER
 
 #include<time.h>
+#include<netinet/in.h>
 #include"../log/log.h"
 
 #define BUFFER_SIZE 64
 
-class util_timer;
+// 单调时钟的当前时间，单位毫秒，定时器的超时时间都使用这个时钟，不受系统时间调整的影响
+inline time_t get_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
 
-// 用户数据结构：客户端socket地址、socket文件描述符和定时器
-struct client_data {
-    sockaddr_in address;
-    int sockfd;
-    util_timer* timer;
-};
+struct client_data;
+class event_loop;
 
 // 定时器类
+// 定时器容器不负责分配和释放定时器，定时器内嵌在client_data中，建立和关闭连接时不需要申请和释放内存
 class util_timer {
     public:
-        util_timer(): prev(nullptr), next(nullptr) {}
+        util_timer(): prev(nullptr), next(nullptr), slot(-1) {}
         
     public:
-        // 任务的超时时间，使用绝对时间
+        // 任务的超时时间，使用get_ms()的绝对时间
         time_t expire;
         // 任务回调函数
         void(*cb_func)(client_data*);
@@ -31,6 +34,23 @@ class util_timer {
         util_timer* prev;
         // 指向后一个定时器
         util_timer* next;
+        // 定时器在时间轮中所在的槽，不在时间轮中时为-1，仅由time_wheel使用
+        int slot;
+};
+
+// 用户数据结构：客户端socket地址、socket文件描述符、定时器和连接所属的事件循环
+struct client_data {
+    sockaddr_in address;
+    int sockfd;
+    // 正在使用的定时器，连接关闭后为NULL
+    util_timer* timer;
+    event_loop* loop;
+    // 连接最后一次有数据传输的时间，单位毫秒，仅在定时器懒惰刷新模式下使用
+    time_t last_active;
+    // 该连接的定时器，随client_data数组预先分配，timer指向它
+    util_timer timer_node;
+    // 连接代数，建立和关闭连接时加一，工作线程的消息带上代数，代数不同的消息属于已关闭的连接
+    unsigned gen;
 };
 
 // 定时器链表类，带头尾节点的升序双向链表
@@ -38,16 +58,6 @@ class sort_timer_lst {
     public:
         sort_timer_lst(): head(nullptr), tail(nullptr) {};
 
-        // 链表被销毁时，删除所有定时器
-        ~sort_timer_lst() {
-            util_timer* tmp = head;
-            while (tmp) {
-                head = tmp->next;
-                delete tmp;
-                tmp = head;
-            }
-        }
-
         // 将目标定时器timer添加到链表中
         void add_timer(util_timer* timer) {
             if (timer == nullptr) {
@@ -93,46 +103,39 @@ class sort_timer_lst {
             }
         }
 
-        // 从链表中删除目标定时器
+        // 从链表中删除目标定时器，定时器之后可以被重新添加
         void del_timer(util_timer* timer) {
             if (!timer) {
                 return;
             }
-            // 以下表示链表中只有目标定时器
             if ((timer == head) && (timer == tail)) {
-                delete timer;
+                // 以下表示链表中只有目标定时器
                 head = nullptr;
                 tail = nullptr;
-                return;
-            }
-            // 如果目标定时器是头节点
-            if (timer == head) {
+            } else if (timer == head) {
+                // 如果目标定时器是头节点
                 head = head->next;
                 head->prev = nullptr;
-                delete timer;
-                return;
-            }
-            // 如果目标定时器是尾节点
-            if (timer == tail) {
+            } else if (timer == tail) {
+                // 如果目标定时器是尾节点
                 tail = tail->prev;
                 tail->next = nullptr;
-                delete timer;
-                return;
+            } else {
+                // 目标定时器位于中间位置
+                timer->prev->next = timer->next;
+                timer->next->prev = timer->prev;
             }
-            // 目标定时器位于中间位置
-            timer->prev->next = timer->next;
-            timer->next->prev = timer->prev;
-            delete timer;
+            timer->prev = nullptr;
+            timer->next = nullptr;
         }
 
-        // SIGALRM信号每次被触发就在其信号处理函数中执行一次tick函数，以处理到期任务
-        // 如果使用统一事件源，处理函数是主函数
+        // 定时器到期时执行一次tick函数，以处理到期任务
         bool tick() {
             if (head == nullptr) {
                 return false;
             }
-            // 获得当前系统时间
-            time_t cur = time(NULL);
+            // 获得当前时间
+            time_t cur = get_ms();
             util_timer* tmp = head;
             // 从头结点开始依次处理每个定时器，直到遇到一个尚未到期的定时器
             while (tmp) {
@@ -140,14 +143,15 @@ class sort_timer_lst {
                 if (cur < tmp->expire) {
                     break;
                 }
-                // 调用超时定时器的回调函数
-                tmp->cb_func(tmp->user_data);
-                // 执行完定时任务后，将它从链表中删除，并重置链表头结点
+                // 先将它从链表中删除并重置链表头结点，再调用超时定时器的回调函数
                 head = tmp->next;
                 if (head) {
                     head->prev = nullptr;
+                } else {
+                    tail = nullptr;
                 }
-                delete tmp;
+                tmp->next = nullptr;
+                tmp->cb_func(tmp->user_data);
                 tmp = head;
             }
             return true;
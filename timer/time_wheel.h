@@ -0,0 +1,213 @@
+#ifndef TIME_WHEEL
+#define TIME_WHEEL
+
+#include<time.h>
+#include"lst_timer.h"
+
+// 分层时间轮，与sort_timer_lst接口相同，可以直接替换
+// 共WHEEL_LEVELS层，每层WHEEL_SLOTS个槽，第L层每个槽的跨度为WHEEL_SLOTS^L个时间单位，时间单位的长度由resolution指定
+// 定时器按到期时间与当前时间的差值放入对应层的槽中，槽内是无序的双向链表
+// 添加、调整和删除都是O(1)，每当低层转完一圈，就把高层对应槽中的定时器重新放入低层
+class time_wheel {
+    public:
+        // 每层槽数的位数
+        static const int WHEEL_BITS = 6;
+        static const int WHEEL_SLOTS = 1 << WHEEL_BITS;
+        static const int WHEEL_MASK = WHEEL_SLOTS - 1;
+        static const int WHEEL_LEVELS = 4;
+        // 时间轮能表示的最大时间差，超出的定时器先放在最高层，转到时重新计算位置
+        static const time_t WHEEL_RANGE = (time_t)1 << (WHEEL_BITS * WHEEL_LEVELS);
+
+        // resolution为一个时间单位的毫秒数，同一时间单位内到期的定时器一起处理
+        time_wheel(int resolution = 1000): m_count(0), m_level0_count(0), m_ticking(false) {
+            for (int i = 0; i < WHEEL_LEVELS * WHEEL_SLOTS; i++) {
+                m_slots[i] = nullptr;
+            }
+            set_resolution(resolution);
+        }
+
+        // 设置时间单位的长度，只能在添加定时器之前调用
+        void set_resolution(int resolution) {
+            m_resolution = resolution > 0 ? resolution : 1;
+            m_current = get_ms() / m_resolution;
+        }
+
+        // 将目标定时器timer添加到时间轮中
+        // 定时器内嵌在client_data中随fd复用，如果仍挂在时间轮中则按新的超时时间移动，不会重复计数
+        void add_timer(util_timer* timer) {
+            if (timer == nullptr) {
+                return;
+            }
+            if (linked(timer)) {
+                unlink(timer);
+            } else {
+                // 时间轮空着时没有调用tick()，当前时间单位已经过时，按过时的位置放入会让下次tick()逐个补转空闲期间的所有时间单位
+                // tick()过程中回调函数重新加入的定时器由tick()继续推进，不能跳过正在处理的时间单位
+                if (m_count == 0 && !m_ticking) {
+                    m_current = get_ms() / m_resolution;
+                }
+                m_count++;
+            }
+            link(timer);
+        }
+
+        // 定时器的超时时间改变后，将其移到新的槽中，延后和提前都可以
+        void adjust_timer(util_timer* timer) {
+            add_timer(timer);
+        }
+
+        // 从时间轮中删除目标定时器，定时器之后可以被重新添加
+        void del_timer(util_timer* timer) {
+            if (!timer || !linked(timer)) {
+                return;
+            }
+            unlink(timer);
+            m_count--;
+        }
+
+        // 处理所有到期的定时器，时间轮为空时返回false
+        bool tick() {
+            if (m_count == 0) {
+                // 没有定时器时直接跳到当前时间，不必逐个时间单位空转
+                m_current = get_ms() / m_resolution;
+                return false;
+            }
+            time_t cur = get_ms() / m_resolution;
+            m_ticking = true;
+            while (m_current <= cur) {
+                int index = m_current & WHEEL_MASK;
+                // 第0层转完一圈，把上层当前槽中的定时器重新分配到下层，上层也转完一圈时继续向上
+                if (index == 0) {
+                    for (int level = 1; level < WHEEL_LEVELS; level++) {
+                        int slot = (m_current >> (level * WHEEL_BITS)) & WHEEL_MASK;
+                        cascade(level * WHEEL_SLOTS + slot);
+                        if (slot != 0) {
+                            break;
+                        }
+                    }
+                }
+                // 第0层当前槽中的定时器都已到期，先把整个槽取下
+                // 回调函数可能把定时器重新加入时间轮，即使又落在当前槽中也留到下一次tick处理
+                util_timer* tmp = m_slots[index];
+                m_slots[index] = nullptr;
+                while (tmp) {
+                    util_timer* next = tmp->next;
+                    if (next) {
+                        next->prev = nullptr;
+                    }
+                    m_count--;
+                    m_level0_count--;
+                    tmp->next = nullptr;
+                    tmp->slot = -1;
+                    // 调用超时定时器的回调函数
+                    tmp->cb_func(tmp->user_data);
+                    tmp = next;
+                }
+                m_current++;
+            }
+            m_ticking = false;
+            return true;
+        }
+
+        // 下一次需要调用tick()的时间，单位毫秒，时间轮为空时返回-1
+        // 第0层的定时器是精确的；上层的定时器要等到低层转完一圈时重新分配，届时再计算一次
+        time_t next_expire() const {
+            if (m_count == 0) {
+                return -1;
+            }
+            // 第0层下一次转完一圈的时间
+            time_t boundary = (m_current | WHEEL_MASK) + 1;
+            if (m_level0_count > 0) {
+                for (time_t unit = m_current; unit < m_current + WHEEL_SLOTS; unit++) {
+                    if (m_slots[unit & WHEEL_MASK]) {
+                        if (m_count == m_level0_count || unit < boundary) {
+                            return unit * m_resolution;
+                        }
+                        break;
+                    }
+                }
+            }
+            return boundary * m_resolution;
+        }
+
+    private:
+        // 定时器是否挂在时间轮中，不在时间轮中的定时器slot为-1
+        static bool linked(const util_timer* timer) {
+            return timer->slot != -1;
+        }
+
+        // 根据超时时间把定时器挂到对应的槽中
+        void link(util_timer* timer) {
+            // 向上取整，保证定时器不会提前到期
+            time_t expire = (timer->expire + m_resolution - 1) / m_resolution;
+            time_t delta = expire - m_current;
+            if (delta < 0) {
+                // 已经到期的定时器放到当前槽，下次tick时处理
+                delta = 0;
+                expire = m_current;
+            }
+            if (delta >= WHEEL_RANGE) {
+                expire = m_current + WHEEL_RANGE - 1;
+                delta = WHEEL_RANGE - 1;
+            }
+            int level = 0;
+            while (delta >= ((time_t)1 << ((level + 1) * WHEEL_BITS))) {
+                level++;
+            }
+            if (level == 0) {
+                m_level0_count++;
+            }
+            int slot = level * WHEEL_SLOTS + ((expire >> (level * WHEEL_BITS)) & WHEEL_MASK);
+            timer->slot = slot;
+            timer->prev = nullptr;
+            timer->next = m_slots[slot];
+            if (m_slots[slot]) {
+                m_slots[slot]->prev = timer;
+            }
+            m_slots[slot] = timer;
+        }
+
+        // 将定时器从所在的槽中取下
+        void unlink(util_timer* timer) {
+            if (timer->prev) {
+                timer->prev->next = timer->next;
+            } else {
+                m_slots[timer->slot] = timer->next;
+            }
+            if (timer->next) {
+                timer->next->prev = timer->prev;
+            }
+            if (timer->slot < WHEEL_SLOTS) {
+                m_level0_count--;
+            }
+            timer->prev = nullptr;
+            timer->next = nullptr;
+            timer->slot = -1;
+        }
+
+        // 把槽中的定时器按剩余时间重新放入时间轮
+        void cascade(int slot) {
+            util_timer* tmp = m_slots[slot];
+            m_slots[slot] = nullptr;
+            while (tmp) {
+                util_timer* next = tmp->next;
+                link(tmp);
+                tmp = next;
+            }
+        }
+
+    private:
+        // 所有层的槽，第L层第i个槽的下标为L * WHEEL_SLOTS + i
+        util_timer* m_slots[WHEEL_LEVELS * WHEEL_SLOTS];
+        // 一个时间单位的毫秒数
+        int m_resolution;
+        // 下一个要处理的时间单位
+        time_t m_current;
+        // 时间轮中定时器的总数和第0层定时器的数量
+        int m_count;
+        int m_level0_count;
+        // 正在tick()中处理到期的定时器
+        bool m_ticking;
+};
+
+#endif